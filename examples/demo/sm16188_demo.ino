@@ -12,6 +12,12 @@ SM16188<D1, D2> sm16188;
 #define DISPLAYS_ACROSS 2
 #define DISPLAYS_DOWN 1
 
+//Runs the scenes below from loop(), see SM16188Scheduler
+SM16188Scheduler<SM16188<D1, D2> > scheduler(sm16188);
+
+//The display is refreshed every 100 ms (Timer1 period), so the stripes step every 200 ms
+#define STRIPE_REFRESHES 2
+
 /*--------------------------------------------------------------------------------------
   Interrupt handler for Timer1 (TimerOne) driven SM16188 refresh scanning, this gets
   called at the period set in Timer1.initialize();
@@ -36,98 +42,171 @@ void setup(void)
 
   //clear/init the SM16188 pixels held in RAM
   sm16188.clearScreen(true); //true is normal (all pixels off), false is negative (all pixels on)
+
+  //serve the serial link every 20 ms and start the first scene
+  Serial.begin(9600);
+  scheduler.every(20, pollSerial);
+  nextScene(NULL);
 }
 
 /*--------------------------------------------------------------------------------------
-  loop
-  Arduino architecture main loop
+  Scenes of the demo. Each one draws its first frame and starts a task that animates it;
+  the scene ends after its time or when the animation says so. Nothing blocks, so the
+  serial link is served all the time.
 --------------------------------------------------------------------------------------*/
-void loop(void)
+byte scene = 0;
+byte step = 0;
+int animation = -1; //task animating the current scene
+int sceneEnd = -1;  //task ending the current scene
+byte brightness = 15;
+
+void nextScene(void *);
+
+//Animate the current scene with task, and move on to the next scene after duration ms
+//(0 when the animation ends the scene itself)
+void play(int task, unsigned long duration)
+{
+  animation = task;
+  if (duration)
+    sceneEnd = scheduler.after(duration, nextScene);
+}
+
+//Clock colon overlay on and off, OR and NOR modes leave the digits alone
+void blinkColon(void *)
 {
-  byte b;
-
-  // 10 x 14 font clock, including demo of OR and NOR modes for pixels so that the flashing colon can be overlayed
-  sm16188.clearScreen(true);
-  sm16188.selectFont(Arial_Black_16);
-  sm16188.drawChar(0, 3, '2', GRAPHICS_NORMAL);
-  sm16188.drawChar(7, 3, '3', GRAPHICS_NORMAL);
-  sm16188.drawChar(17, 3, '4', GRAPHICS_NORMAL);
-  sm16188.drawChar(25, 3, '5', GRAPHICS_NORMAL);
-  sm16188.drawChar(15, 3, ':', GRAPHICS_OR); // clock colon overlay on
-  delay(1000);
-  sm16188.drawChar(15, 3, ':', GRAPHICS_NOR); // clock colon overlay off
-  delay(1000);
-  sm16188.drawChar(15, 3, ':', GRAPHICS_OR); // clock colon overlay on
-  delay(1000);
-  sm16188.drawChar(15, 3, ':', GRAPHICS_NOR); // clock colon overlay off
-  delay(1000);
-  sm16188.drawChar(15, 3, ':', GRAPHICS_OR); // clock colon overlay on
-  delay(1000);
-
-  // drawMarquee not implemented
-  //  sm16188.drawMarquee("Scrolling Text",14,(32*DISPLAYS_ACROSS)-1,0);
-  //  long start=millis();
-  //  long timer=start;
-  //  boolean ret=false;
-  //  while(!ret){
-  //    if ((timer+30) < millis()) {
-  //      ret=sm16188.stepMarquee(-1,0);
-  //      timer=millis();
-  //    }
-  //  }
-
-  // half the pixels on
-  sm16188.drawTestPattern(PATTERN_ALT_0);
-  delay(1000);
-  // the other half on
-  sm16188.drawTestPattern(PATTERN_ALT_1);
-  delay(1000);
-
-  // display some text
-  sm16188.clearScreen(true);
-  sm16188.selectFont(System5x7);
-
-  for (byte x = 0; x < DISPLAYS_ACROSS; x++)
+  step++;
+  sm16188.drawChar(15, 3, ':', (step & 1) ? GRAPHICS_NOR : GRAPHICS_OR);
+}
+
+void scrollText(void *)
+{
+  if (sm16188.stepMarquee(-1, 0))
+    nextScene(NULL);
+}
+
+//Half the pixels on, then the other half
+void alternatePixels(void *)
+{
+  step++;
+  sm16188.drawTestPattern((step & 1) ? PATTERN_ALT_1 : PATTERN_ALT_0);
+}
+
+//An X, a circle and a filled box on every panel, one shape at a time
+void drawShapes(void *)
+{
+  byte panel = step / 3;
+  if (panel == DISPLAYS_ACROSS * DISPLAYS_DOWN)
   {
-    for (byte y = 0; y < DISPLAYS_DOWN; y++)
-    {
-      sm16188.drawString(2 + (32 * x), 1 + (16 * y), "freet", 5, GRAPHICS_NORMAL);
-      sm16188.drawString(2 + (32 * x), 9 + (16 * y), "ronic", 5, GRAPHICS_NORMAL);
-    }
+    nextScene(NULL);
+    return;
+  }
+  int ix = 32 * (panel % DISPLAYS_ACROSS);
+  int iy = 16 * (panel / DISPLAYS_ACROSS);
+  switch (step % 3)
+  {
+  case 0:
+    sm16188.drawLine(0 + ix, 0 + iy, 11 + ix, 15 + iy, GRAPHICS_NORMAL);
+    sm16188.drawLine(0 + ix, 15 + iy, 11 + ix, 0 + iy, GRAPHICS_NORMAL);
+    break;
+  case 1:
+    sm16188.drawCircle(16 + ix, 8 + iy, 5, GRAPHICS_NORMAL);
+    break;
+  case 2:
+    sm16188.drawFilledBox(24 + ix, 3 + iy, 29 + ix, 13 + iy, GRAPHICS_NORMAL);
+    break;
+  }
+  step++;
+}
+
+//Stripe chaser, one step per STRIPE_REFRESHES refreshes of the display
+void chaseStripes(void *)
+{
+  if (step == 20)
+  {
+    nextScene(NULL);
+    return;
   }
-  delay(2000);
+  sm16188.drawTestPattern((step & 1) + PATTERN_STRIPE_0);
+  step++;
+}
 
-  // draw a border rectangle around the outside of the display
-  sm16188.clearScreen(true);
-  sm16188.drawBox(0, 0, (32 * DISPLAYS_ACROSS) - 1, (16 * DISPLAYS_DOWN) - 1, GRAPHICS_NORMAL);
-  delay(1000);
+void nextScene(void *)
+{
+  scheduler.cancel(animation);
+  scheduler.cancel(sceneEnd);
+  animation = -1;
+  sceneEnd = -1;
+  step = 0;
 
-  for (byte y = 0; y < DISPLAYS_DOWN; y++)
+  switch (scene++)
   {
+  case 0:
+    // 10 x 14 font clock with a flashing colon
+    sm16188.clearScreen(true);
+    sm16188.selectFont(Arial_Black_16);
+    sm16188.drawChar(0, 3, '2', GRAPHICS_NORMAL);
+    sm16188.drawChar(7, 3, '3', GRAPHICS_NORMAL);
+    sm16188.drawChar(17, 3, '4', GRAPHICS_NORMAL);
+    sm16188.drawChar(25, 3, '5', GRAPHICS_NORMAL);
+    sm16188.drawChar(15, 3, ':', GRAPHICS_OR);
+    play(scheduler.every(1000, blinkColon), 5000);
+    break;
+  case 1:
+    // scrolling text
+    sm16188.clearScreen(true);
+    sm16188.drawMarquee("Scrolling Text", 14, (32 * DISPLAYS_ACROSS) - 1, 0);
+    play(scheduler.every(30, scrollText), 0);
+    break;
+  case 2:
+    sm16188.drawTestPattern(PATTERN_ALT_0);
+    play(scheduler.every(1000, alternatePixels), 2000);
+    break;
+  case 3:
+    // some text
+    sm16188.clearScreen(true);
+    sm16188.selectFont(System5x7);
     for (byte x = 0; x < DISPLAYS_ACROSS; x++)
     {
-      // draw an X
-      int ix = 32 * x;
-      int iy = 16 * y;
-      sm16188.drawLine(0 + ix, 0 + iy, 11 + ix, 15 + iy, GRAPHICS_NORMAL);
-      sm16188.drawLine(0 + ix, 15 + iy, 11 + ix, 0 + iy, GRAPHICS_NORMAL);
-      delay(1000);
-
-      // draw a circle
-      sm16188.drawCircle(16 + ix, 8 + iy, 5, GRAPHICS_NORMAL);
-      delay(1000);
-
-      // draw a filled box
-      sm16188.drawFilledBox(24 + ix, 3 + iy, 29 + ix, 13 + iy, GRAPHICS_NORMAL);
-      delay(1000);
+      for (byte y = 0; y < DISPLAYS_DOWN; y++)
+      {
+        sm16188.drawString(2 + (32 * x), 1 + (16 * y), "freet", 5, GRAPHICS_NORMAL);
+        sm16188.drawString(2 + (32 * x), 9 + (16 * y), "ronic", 5, GRAPHICS_NORMAL);
+      }
     }
+    play(-1, 2000);
+    break;
+  case 4:
+    // a border rectangle around the outside of the display, then the shapes
+    sm16188.clearScreen(true);
+    sm16188.drawBox(0, 0, (32 * DISPLAYS_ACROSS) - 1, (16 * DISPLAYS_DOWN) - 1, GRAPHICS_NORMAL);
+    play(scheduler.every(1000, drawShapes), 0);
+    break;
+  default:
+    scene = 0;
+    play(scheduler.everyFrame(STRIPE_REFRESHES, chaseStripes), 0);
+    break;
   }
+}
 
-  // stripe chaser
-  for (b = 0; b < 20; b++)
+//Serial link, polled while the scenes run: '+' and '-' change the brightness
+void pollSerial(void *)
+{
+  while (Serial.available())
   {
-    sm16188.drawTestPattern((b & 1) + PATTERN_STRIPE_0);
-    delay(200);
+    char c = Serial.read();
+    if (c == '+' && brightness < 15)
+      brightness++;
+    else if (c == '-' && brightness > 0)
+      brightness--;
+    sm16188.setBrightness(brightness);
   }
-  delay(200);
+}
+
+/*--------------------------------------------------------------------------------------
+  loop
+  Arduino architecture main loop
+--------------------------------------------------------------------------------------*/
+void loop(void)
+{
+  scheduler.run();
 }
@@ -0,0 +1,90 @@
+/*--------------------------------------------------------------------------------------
+ Arduino.h - Minimal host (Linux) stand-in for the Arduino core.
+
+ Provides only what sm16188.h, the bundled fonts and the host tools use. Pin and
+ interrupt calls are routed to SM16188Host (see sm16188_host.h).
+--------------------------------------------------------------------------------------*/
+
+#ifndef SM16188_HOST_ARDUINO_H_
+#define SM16188_HOST_ARDUINO_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "sm16188_host.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+inline unsigned long micros()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+inline void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < SM16188_HOST_PINS)
+        SM16188Host::instance().pinModes[pin] = mode;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin < SM16188_HOST_PINS)
+        SM16188Host::instance().pinLevels[pin] = val;
+}
+
+inline void noInterrupts()
+{
+    SM16188Host &host = SM16188Host::instance();
+    if (host.interruptsEnabled)
+    {
+        host.interruptBlocks++;
+        host.interruptsOffNs = 0;
+    }
+    host.interruptsEnabled = false;
+}
+
+inline void interrupts()
+{
+    SM16188Host &host = SM16188Host::instance();
+    if (!host.interruptsEnabled && host.interruptsOffNs > host.longestInterruptsOffNs)
+        host.longestInterruptsOffNs = host.interruptsOffNs;
+    host.interruptsEnabled = true;
+    host.serviceInterrupt();
+}
+
+#endif /* SM16188_HOST_ARDUINO_H_ */
@@ -0,0 +1,342 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_bench.cpp - Host microbenchmarks for the sm16188 drawing primitives and refresh.
+
+ Reports ns/op for each primitive, and the number of pulses, on-wire time per frame and
+ longest interrupts-off window of updateScreen() and updateScreenStep() at the calibrated
+ bit timing, for every panel layout from 1x1 up to 8x3. A second table compares the size
+ and drawing speed of the bundled fonts in their classic form, rebuilt with a range table,
+ with aligned bands and with RLE compressed glyphs.
+
+ Build and run:  make bench
+ sm16188_bench -t only checks the bit timing and exits with 1 if a phase is out of spec.
+--------------------------------------------------------------------------------------*/
+
+#include <sm16188.h>
+#include <sm16188_font.h>
+#include <fonts/SystemFont5x7.h>
+#include <fonts/Arial14.h>
+#include <fonts/Arial_black_16.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+const uint8_t D1 = 2;
+const uint8_t D2 = 3;
+
+typedef SM16188<D1, D2> Display;
+
+struct Layout
+{
+    byte wide;
+    byte high;
+    bool fixed; //geometry given as template parameters
+};
+
+static const Layout layouts[] = {{1, 1, false}, {2, 1, false}, {4, 1, false}, {5, 1, false}, {8, 1, false},
+                                 {1, 2, false}, {2, 2, false}, {4, 2, false}, {8, 2, false}, {8, 3, false}, {5, 1, true},
+                                 {8, 2, true}};
+
+//Minimum wall time per measurement, and measurements per result (the fastest is kept)
+static const double minSeconds = 0.01;
+static const int repeats = 5;
+
+//Run op(i) repeatedly, doubling the iteration count until the run is long enough
+template <class Op>
+static double nsPerOp(Op op)
+{
+    double best = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        for (unsigned long n = 1;; n *= 2)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (unsigned long i = 0; i < n; i++)
+                op(i);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (seconds >= minSeconds)
+            {
+                double ns = seconds * 1e9 / n;
+                if (r == 0 || ns < best)
+                    best = ns;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+//Print one phase of the bit timing against its datasheet value, false when it is out of spec.
+//The cycles are those the bit loop of the target sends, see SM16188_BIT_T0H_CYCLES.
+static bool checkPhase(const char *name, unsigned long cycles, unsigned long ns)
+{
+    long actual = SM16188_CYCLES_TO_NS(cycles);
+    long error = actual - (long)ns;
+    bool ok = error <= SM16188_TIMING_TOLERANCE_NS && -error <= SM16188_TIMING_TOLERANCE_NS;
+    printf("  %s %3lu cycles = %4ld ns (datasheet %lu +/- %d ns) %s\n", name, cycles, actual, ns,
+           SM16188_TIMING_TOLERANCE_NS, ok ? "ok" : "OUT OF SPEC");
+    return ok;
+}
+
+//Check every phase of the bit timing at F_CPU
+static bool checkTiming()
+{
+    printf("bit timing at F_CPU = %lu Hz, %s bit loop\n", (unsigned long)F_CPU, SM16188_HOST_AVR ? "AVR" : "ESP32");
+    bool ok = checkPhase("T0H", SM16188_BIT_T0H_CYCLES, SM16188_T0H_NS);
+    ok &= checkPhase("T0L", SM16188_BIT_T0L_CYCLES, SM16188_T0L_NS);
+    ok &= checkPhase("T1H", SM16188_BIT_T1H_CYCLES, SM16188_T1H_NS);
+    ok &= checkPhase("T1L", SM16188_BIT_T1L_CYCLES, SM16188_T1L_NS);
+    return ok;
+}
+
+static const char text[] = "The quick brown fox jumps over the lazy dog";
+
+//Results of measurements without side effects go here, so they are not optimised away
+static volatile int sink;
+
+//24x12 icon, column-major, two bytes per column
+static const uint8_t icon[24 * 2] PROGMEM = {
+    0xF0, 0x0F, 0x08, 0x08, 0x04, 0x04, 0xE2, 0x04, 0x12, 0x05, 0x0A, 0x06, 0x0A, 0x06, 0x12, 0x05,
+    0xE2, 0x04, 0x04, 0x04, 0x08, 0x08, 0xF0, 0x0F, 0xF0, 0x0F, 0x08, 0x08, 0x04, 0x04, 0xE2, 0x04,
+    0x12, 0x05, 0x0A, 0x06, 0x0A, 0x06, 0x12, 0x05, 0xE2, 0x04, 0x04, 0x04, 0x08, 0x08, 0xF0, 0x0F};
+
+static const size_t layoutCount = sizeof(layouts) / sizeof(layouts[0]);
+
+//One line of the result table, a value per layout
+struct Row
+{
+    const char *name;
+    const char *unit;
+    double values[layoutCount];
+};
+
+static std::vector<Row> rows;
+
+static void record(size_t layout, const char *name, const char *unit, double value)
+{
+    size_t r = 0;
+    while (r < rows.size() && strcmp(rows[r].name, name) != 0)
+        r++;
+    if (r == rows.size())
+    {
+        Row row = {name, unit, {0}};
+        rows.push_back(row);
+    }
+    rows[r].values[layout] = value;
+}
+
+static void printTable()
+{
+    printf("%-17s %-13s", "primitive", "unit");
+    for (size_t l = 0; l < layoutCount; l++)
+    {
+        char name[12];
+        snprintf(name, sizeof(name), "%ux%u%s", layouts[l].wide, layouts[l].high, layouts[l].fixed ? "f" : "");
+        printf(" %9s", name);
+    }
+    printf("\n");
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        printf("%-17s %-13s", rows[r].name, rows[r].unit);
+        for (size_t l = 0; l < layoutCount; l++)
+            printf(" %9.1f", rows[r].values[l]);
+        printf("\n");
+    }
+}
+
+//Measure every primitive on one display, results go to column l of the table
+template <class Display>
+static void runLayout(size_t l, Display &display)
+{
+    SM16188Host &host = SM16188Host::instance();
+
+    const unsigned int width = SM16188_PIXELS_ACROSS * layouts[l].wide;
+    const unsigned int height = SM16188_PIXELS_DOWN * layouts[l].high;
+
+    record(l, "writePixel", "ns/op", nsPerOp([&](unsigned long i) {
+               display.writePixel(i % width, (i / width) % height, GRAPHICS_TOGGLE, true);
+           }));
+    record(l, "drawLine", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawLine(0, i % height, width - 1, height - 1 - i % height, GRAPHICS_TOGGLE);
+           }));
+    record(l, "drawCircle", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawCircle(width / 2, height / 2, 2 + i % 6, GRAPHICS_TOGGLE);
+           }));
+    record(l, "  long line", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawLine(-2000, i % height - 500, width + 2000, height + 500 - i % height, GRAPHICS_TOGGLE);
+           }));
+    record(l, "  around screen", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawCircle(width / 2, height / 2, width + i % 6, GRAPHICS_TOGGLE);
+           }));
+    record(l, "drawFilledCircle", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawFilledCircle(width / 2, height / 2, 2 + i % 6, GRAPHICS_TOGGLE);
+           }));
+    record(l, "drawArc", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawArc(width / 2, height / 2, 7, 3, -120, i % 240 - 120, GRAPHICS_TOGGLE);
+           }));
+    record(l, "drawFilledBox", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawFilledBox(i % 4, i % 3, width - 1 - i % 4, height - 1 - i % 3, GRAPHICS_TOGGLE);
+           }));
+    record(l, "clearScreen", "ns/op", nsPerOp([&](unsigned long i) {
+               display.clearScreen(i & 1);
+           }));
+    record(l, "clearBox", "ns/op", nsPerOp([&](unsigned long i) {
+               display.clearBox(i % 5, 3, width / 2 + i % 5, height - 3, i & 1);
+           }));
+
+    record(l, "drawBitmap", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawBitmap(i % width - 12, i % 9 - 2, icon, 24, 12, i % 5);
+           }));
+
+    display.selectFont(System5x7);
+    record(l, "drawChar 5x7", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawChar((i * 6) % width, 0, 'A' + i % 26, GRAPHICS_NORMAL);
+           }));
+    display.selectFont(Arial_Black_16);
+    record(l, "drawChar 16", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawChar((i * 11) % width, 0, 'a' + i % 26, GRAPHICS_NORMAL);
+           }));
+    display.selectFont(Arial_14);
+    record(l, "drawString", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawString(i % 8, 1, text, sizeof(text) - 1, GRAPHICS_NORMAL);
+           }));
+    record(l, "measureString", "ns/op", nsPerOp([&](unsigned long i) {
+               sink = display.measureString(text, sizeof(text) - 1 - i % 8);
+           }));
+    record(l, "drawTextBox", "ns/op", nsPerOp([&](unsigned long i) {
+               display.drawTextBox(i % 4, 0, width - 8, height, text, sizeof(text) - 1, ALIGN_CENTER, GRAPHICS_NORMAL);
+           }));
+    display.drawMarquee(text, sizeof(text) - 1, width - 1, 1);
+    record(l, "stepMarquee", "ns/op", nsPerOp([&](unsigned long) {
+               display.stepMarquee(-1, 0);
+           }));
+
+    display.setGrayscale(4);
+    record(l, "writePixelGray", "ns/op", nsPerOp([&](unsigned long i) {
+               display.writePixelGray(i % width, (i / width) % height, i & 15);
+           }));
+    display.setGrayscale(1);
+
+#if SM16188_TX_BUFFER
+    record(l, "encodeFrame", "ns/op", nsPerOp([&](unsigned long) {
+               display.encodeFrame();
+           }));
+#endif
+    record(l, "updateScreen", "ns/op", nsPerOp([&](unsigned long) {
+               display.invalidate();
+               display.updateScreen();
+           }));
+    display.setKeepAlive(0);
+    record(l, "  unchanged", "ns/op", nsPerOp([&](unsigned long) {
+               display.updateScreen();
+           }));
+
+    host.clearTrace();
+    display.invalidate();
+    host.capture = true;
+    display.updateScreen();
+    host.capture = false;
+    double wireUs = 0;
+    for (size_t p = 0; p < host.trace.size(); p++)
+        wireUs += (host.trace[p].highNs + host.trace[p].lowNs) / 1000.0;
+    record(l, "  pulses", "pulses/frame", host.pulsesTotal);
+    record(l, "  wire time", "us/frame", wireUs);
+    record(l, "  frame irq-off", "us", host.longestInterruptsOffNs / 1000.0);
+
+    record(l, "updateScreenStep", "ns/frame", nsPerOp([&](unsigned long) {
+               display.invalidate();
+               while (!display.updateScreenStep(8))
+               {
+               }
+           }));
+    host.clearTrace();
+    display.invalidate();
+    while (!display.updateScreenStep(8))
+    {
+    }
+    record(l, "  step irq-off", "us", host.longestInterruptsOffNs / 1000.0);
+}
+
+//drawChar() and single column marquee steps in font, on a 4x2 display
+static void benchFont(const char *name, const uint8_t *font, size_t bytes, const char *format)
+{
+    static Display display;
+    static bool started = display.begin(4, 2);
+    if (!started)
+        return;
+    const unsigned int width = SM16188_PIXELS_ACROSS * 4;
+
+    display.selectFont(font);
+    double drawChar = nsPerOp([&](unsigned long i) {
+        display.drawChar((i * 7) % width, 0, 'A' + i % 58, GRAPHICS_NORMAL);
+    });
+    display.clearScreen(true);
+    display.drawMarquee(text, sizeof(text) - 1, width - 1, 0);
+    double stepMarquee = nsPerOp([&](unsigned long) {
+        display.stepMarquee(-1, 0);
+    });
+    printf("%-17s %-8s %7zu %12.1f %15.1f\n", name, format, bytes, drawChar, stepMarquee);
+}
+
+static void benchFonts()
+{
+    const char *names[] = {"System5x7", "Arial_14", "Arial_Black_16", "Arial_Black_16x2"};
+    const uint8_t *fonts[] = {System5x7, Arial_14, Arial_Black_16, NULL};
+    size_t sizes[] = {sizeof(System5x7), sizeof(Arial_14), sizeof(Arial_Black_16), 0};
+
+    printf("%-17s %-8s %7s %12s %15s\n", "font", "format", "bytes", "drawChar ns", "stepMarquee ns");
+    for (size_t f = 0; f < sizeof(fonts) / sizeof(fonts[0]); f++)
+    {
+        SM16188FontSource source = sm16188ReadFont(fonts[f] ? fonts[f] : Arial_Black_16);
+        source = sm16188CopyFont(source, fonts[f] ? 1 : 2, false);
+        std::vector<uint8_t> classic = sm16188BuildClassicFont(source);
+        if (fonts[f])
+            benchFont(names[f], fonts[f], sizes[f], "classic");
+        else if (!classic.empty())
+            benchFont(names[f], classic.data(), classic.size(), "classic");
+        std::vector<uint8_t> ranges = sm16188BuildFont(source, false);
+        benchFont(names[f], ranges.data(), ranges.size(), "ranges");
+        source = sm16188CopyFont(source, 1, true);
+        std::vector<uint8_t> aligned = sm16188BuildFont(source, false);
+        std::vector<uint8_t> rle = sm16188BuildFont(source, true);
+        benchFont(names[f], aligned.data(), aligned.size(), "aligned");
+        benchFont(names[f], rle.data(), rle.size(), "rle");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // -t only checks the bit timing, for make check
+    bool timed = checkTiming();
+    if (argc > 1 && strcmp(argv[1], "-t") == 0)
+        return timed ? 0 : 1;
+    printf("\n");
+
+    for (size_t l = 0; l < layoutCount; l++)
+    {
+        if (!layouts[l].fixed)
+        {
+            Display display;
+            display.begin(layouts[l].wide, layouts[l].high);
+            runLayout(l, display);
+        }
+        else if (layouts[l].wide == 5 && layouts[l].high == 1)
+        {
+            static SM16188<D1, D2, 5, 1> display;
+            display.begin();
+            runLayout(l, display);
+        }
+        else if (layouts[l].wide == 8 && layouts[l].high == 2)
+        {
+            static SM16188<D1, D2, 8, 2> display;
+            display.begin();
+            runLayout(l, display);
+        }
+    }
+
+    printTable();
+    printf("\n");
+    benchFonts();
+    return timed ? 0 : 1;
+}
@@ -0,0 +1,863 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_check.cpp - Regression checks for the fast paths of the sm16188 library.
+
+ Draws random cases on two displays, one through the library function under test and one
+ pixel by pixel with writePixel() as the code it replaced did, and compares the
+ framebuffers after every case. Random clips are pushed on both. The refresh, fade and
+ grayscale sections check what updateScreen() sends, from the pulses SM16188Host records.
+ Prints a line per section and the first differences, and exits with 1 when any case
+ differs.
+
+ Build and run:  make check
+--------------------------------------------------------------------------------------*/
+
+#include <sm16188.h>
+#include <sm16188_font.h>
+#include <sm16188_wave.h>
+#include <fonts/SystemFont5x7.h>
+#include <fonts/Arial14.h>
+#include <fonts/Arial_black_16.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK_WIDE 3
+#define CHECK_HIGH 2
+
+typedef SM16188<1, 2> Display;
+
+static const int pixelsWide = SM16188_PIXELS_ACROSS * CHECK_WIDE;
+static const int pixelsHigh = SM16188_PIXELS_DOWN * CHECK_HIGH;
+
+//The display drawn by the function under test, and the one drawn pixel by pixel
+static Display fast;
+static Display slow;
+
+//Differences found in the current section, and the case being drawn
+static unsigned long failures;
+static char drawn[160];
+
+//Coordinate from a little beyond the display on either side
+static int randomCoordinate(int size)
+{
+    return rand() % (size + 24) - 12;
+}
+
+//Give both displays the same random frame
+static void randomFill()
+{
+    for (int x = 0; x < pixelsWide; x++)
+    {
+        for (int y = 0; y < pixelsHigh; y++)
+        {
+            bool on = rand() & 1;
+            fast.writePixel(x, y, GRAPHICS_NORMAL, on);
+            slow.writePixel(x, y, GRAPHICS_NORMAL, on);
+        }
+    }
+}
+
+//Push the same random clip on both displays, or none; false when none was pushed
+static bool randomClip()
+{
+    if (rand() % 3 == 0)
+        return false;
+    int x = randomCoordinate(pixelsWide);
+    int y = randomCoordinate(pixelsHigh);
+    int w = rand() % pixelsWide + 1;
+    int h = rand() % pixelsHigh + 1;
+    fast.pushClip(x, y, w, h);
+    slow.pushClip(x, y, w, h);
+    snprintf(drawn + strlen(drawn), sizeof(drawn) - strlen(drawn), " in clip %d,%d %dx%d", x, y, w, h);
+    return true;
+}
+
+static void endClip(bool clipped)
+{
+    if (!clipped)
+        return;
+    fast.popClip();
+    slow.popClip();
+}
+
+//Compare the framebuffers after a case; on a difference report it and start both over
+static void compare()
+{
+    const byte *a = fast.frameBuffer();
+    const byte *b = slow.frameBuffer();
+    int columnBytes = 2 * CHECK_HIGH;
+    if (memcmp(a, b, pixelsWide * columnBytes) == 0)
+        return;
+    if (failures < 10)
+    {
+        for (int x = 0; x < pixelsWide; x++)
+        {
+            for (int y = 0; y < pixelsHigh; y++)
+            {
+                int bit = (a[x * columnBytes + y / 8] >> (y & 7)) & 1;
+                if (bit != ((b[x * columnBytes + y / 8] >> (y & 7)) & 1))
+                {
+                    printf("  %s: display pixel %d,%d is %d, %d drawn pixel by pixel\n", drawn, x, y, bit, !bit);
+                    x = pixelsWide;
+                    break;
+                }
+            }
+        }
+    }
+    failures++;
+    randomFill();
+}
+
+//The Bresenham line drawLine() used before lines were clipped and written as byte masks
+static void slowLine(int x1, int y1, int x2, int y2, byte bGraphicsMode)
+{
+    int dy = y2 - y1;
+    int dx = x2 - x1;
+    int stepx = dx < 0 ? -1 : 1;
+    int stepy = dy < 0 ? -1 : 1;
+    dx = abs(dx) << 1;
+    dy = abs(dy) << 1;
+
+    slow.writePixel(x1, y1, bGraphicsMode, true);
+    if (dx > dy)
+    {
+        int fraction = dy - (dx >> 1);
+        while (x1 != x2)
+        {
+            if (fraction >= 0)
+            {
+                y1 += stepy;
+                fraction -= dx;
+            }
+            x1 += stepx;
+            fraction += dy;
+            slow.writePixel(x1, y1, bGraphicsMode, true);
+        }
+    }
+    else
+    {
+        int fraction = dx - (dy >> 1);
+        while (y1 != y2)
+        {
+            if (fraction >= 0)
+            {
+                x1 += stepx;
+                fraction -= dy;
+            }
+            y1 += stepy;
+            fraction += dx;
+            slow.writePixel(x1, y1, bGraphicsMode, true);
+        }
+    }
+}
+
+//drawLine(), drawFilledBox(), drawBox() and clearBox(), which write byte masks, against the
+//line, column and pixel loops they replaced
+static unsigned long checkSpans()
+{
+    const char *names[] = {"drawLine", "drawFilledBox", "drawBox", "clearBox"};
+    const unsigned long cases = 40000;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        int x1 = randomCoordinate(pixelsWide);
+        int y1 = randomCoordinate(pixelsHigh);
+        int x2 = randomCoordinate(pixelsWide);
+        int y2 = randomCoordinate(pixelsHigh);
+        // a third of them axis-aligned, which take the byte mask path in drawLine()
+        if (rand() % 3 == 0)
+        {
+            if (rand() & 1)
+                x2 = x1;
+            else
+                y2 = y1;
+        }
+        byte mode = rand() % 5;
+        int shape = rand() % 4;
+        snprintf(drawn, sizeof(drawn), "%s(%d, %d, %d, %d, %d)", names[shape], x1, y1, x2, y2, mode);
+        bool clipped = randomClip();
+        switch (shape)
+        {
+        case 0:
+            fast.drawLine(x1, y1, x2, y2, mode);
+            slowLine(x1, y1, x2, y2, mode);
+            break;
+        case 1:
+            fast.drawFilledBox(x1, y1, x2, y2, mode);
+            for (int x = x1; x <= x2; x++)
+                slowLine(x, y1, x, y2, mode);
+            break;
+        case 2:
+            fast.drawBox(x1, y1, x2, y2, mode);
+            slowLine(x1, y1, x2, y1, mode);
+            slowLine(x2, y1, x2, y2, mode);
+            slowLine(x2, y2, x1, y2, mode);
+            slowLine(x1, y2, x1, y1, mode);
+            break;
+        case 3:
+            // mode is the bNormal flag here
+            fast.clearBox(x1, y1, x2, y2, mode & 1);
+            for (int x = x1 < x2 ? x1 : x2; x <= (x1 < x2 ? x2 : x1); x++)
+            {
+                for (int y = y1 < y2 ? y1 : y2; y <= (y1 < y2 ? y2 : y1); y++)
+                    slow.writePixel(x, y, GRAPHICS_NORMAL, !(mode & 1));
+            }
+            break;
+        }
+        endClip(clipped);
+        compare();
+    }
+    return cases;
+}
+
+//drawBitmap() of random bitmaps up to 40x40 in every graphics mode, from partly off one side
+//of the display to partly off the other and in random clips, against writePixel() of each bit
+static unsigned long checkBitmaps()
+{
+    const unsigned long cases = 20000;
+    std::vector<uint8_t> bitmap;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        int width = rand() % 40 + 1;
+        int height = rand() % 40 + 1;
+        int bands = (height + 7) / 8;
+        bitmap.resize(width * bands);
+        for (size_t i = 0; i < bitmap.size(); i++)
+            bitmap[i] = rand();
+        int x = rand() % (pixelsWide + width) - width / 2 - width / 4;
+        int y = rand() % (pixelsHigh + height) - height / 2 - height / 4;
+        byte mode = rand() % 5;
+        snprintf(drawn, sizeof(drawn), "drawBitmap(%d, %d, %dx%d, %d)", x, y, width, height, mode);
+        bool clipped = randomClip();
+        fast.drawBitmap(x, y, bitmap.data(), width, height, mode, rand() & 1);
+        for (int j = 0; j < width; j++)
+        {
+            for (int k = 0; k < height; k++)
+                slow.writePixel(x + j, y + k, mode, (bitmap[j * bands + k / 8] >> (k & 7)) & 1);
+        }
+        endClip(clipped);
+        compare();
+    }
+    return cases;
+}
+
+
+//sides of the two scaled directions it is on
+static bool slowInArc(long dx, long dy, int startAngle, int endAngle)
+{
+    long sweep = (long)endAngle - startAngle;
+    if (sweep >= 360 || sweep <= -360)
+        return true;
+    sweep = ((sweep % 360) + 360) % 360;
+    long startX = lround(sin(startAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+    long startY = lround(-cos(startAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+    long endX = lround(sin(endAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+    long endY = lround(-cos(endAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+    long fromStart = startX * dy - startY * dx;
+    long fromEnd = endX * dy - endY * dx;
+    if (sweep == 0)
+        return false;
+    if (sweep <= 180)
+        return fromStart >= 0 && fromEnd <= 0;
+    return !(fromEnd > 0 && fromStart < 0);
+}
+
+//drawFilledCircle(), drawFilledEllipse(), drawFilledRoundBox() and drawArc(), which write a
+//span per column, against writePixel() of each pixel that passes the test in their comments
+static unsigned long checkShapes()
+{
+    const char *names[] = {"drawFilledCircle", "drawFilledEllipse", "drawFilledRoundBox", "drawArc"};
+    const unsigned long cases = 20000;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        int x = randomCoordinate(pixelsWide);
+        int y = randomCoordinate(pixelsHigh);
+        int a = rand() % 41 - 8;
+        int b = rand() % 41 - 8;
+        int c = rand() % 41 - 8;
+        int d = rand() % 41 - 8;
+        byte mode = rand() % 5;
+        int shape = rand() % 4;
+        snprintf(drawn, sizeof(drawn), "%s(%d, %d, %d, %d, %d, %d, %d)", names[shape], x, y, a, b, c, d, mode);
+        bool clipped = randomClip();
+        switch (shape)
+        {
+        case 0:
+            fast.drawFilledCircle(x, y, a, mode);
+            for (int dx = -abs(a); dx <= abs(a); dx++)
+            {
+                for (int dy = -abs(a); dy <= abs(a); dy++)
+                {
+                    if (dx * dx + dy * dy <= a * a + abs(a))
+                        slow.writePixel(x + dx, y + dy, mode, true);
+                }
+            }
+            break;
+        case 1:
+        {
+            fast.drawFilledEllipse(x, y, a, b, mode);
+            long across = (2 * abs(a) + 1) * (2 * abs(a) + 1);
+            long down = (2 * abs(b) + 1) * (2 * abs(b) + 1);
+            for (int dx = -abs(a); dx <= abs(a); dx++)
+            {
+                for (int dy = -abs(b); dy <= abs(b); dy++)
+                {
+                    if (4 * down * dx * dx + 4 * across * dy * dy <= across * down)
+                        slow.writePixel(x + dx, y + dy, mode, true);
+                }
+            }
+            break;
+        }
+        case 2:
+        {
+            // the corners of x, y to x + a, y + b, at the radius reduced to fit
+            int right = x + a;
+            int bottom = y + b;
+            int radius = c < 0 ? 0 : c;
+            radius = radius > abs(a) / 2 ? abs(a) / 2 : radius;
+            radius = radius > abs(b) / 2 ? abs(b) / 2 : radius;
+            fast.drawFilledRoundBox(x, y, right, bottom, c, mode);
+            int left = x < right ? x : right;
+            int top = y < bottom ? y : bottom;
+            for (int px = left; px <= left + abs(a); px++)
+            {
+                for (int py = top; py <= top + abs(b); py++)
+                {
+                    // distance to the box inset by the radius on each side
+                    int dx = px < left + radius ? left + radius - px : px > left + abs(a) - radius ? px - left - abs(a) + radius : 0;
+                    int dy = py < top + radius ? top + radius - py : py > top + abs(b) - radius ? py - top - abs(b) + radius : 0;
+                    if (dx * dx + dy * dy <= radius * radius + radius)
+                        slow.writePixel(px, py, mode, true);
+                }
+            }
+            break;
+        }
+        case 3:
+        {
+            // angles from -720 to 720, half of them multiples of 45 degrees
+            int start = rand() % 1441 - 720;
+            int end = rand() & 1 ? start + rand() % 721 - 360 : rand() % 1441 - 720;
+            if (rand() & 1)
+            {
+                start -= start % 45;
+                end -= end % 45;
+            }
+            snprintf(drawn, sizeof(drawn), "drawArc(%d, %d, %d, %d, %d, %d, %d)", x, y, a, b, start, end, mode);
+            fast.drawArc(x, y, a, b, start, end, mode);
+            int inner = a - b;
+            for (int dx = -a; b > 0 && dx <= a; dx++)
+            {
+                for (int dy = -a; dy <= a; dy++)
+                {
+                    int r2 = dx * dx + dy * dy;
+                    if (r2 <= a * a + a && (inner < 0 || r2 > inner * inner + inner) && slowInArc(dx, dy, start, end))
+                        slow.writePixel(x + dx, y + dy, mode, true);
+                }
+            }
+            break;
+        }
+        }
+        endClip(clipped);
+        compare();
+    }
+    return cases;
+}
+//A glyph drawn pixel by pixel as drawChar() did before it wrote column bytes: bit k of band i
+//goes to row offset + k, for rows from i * 8 down to the row under the glyph, which the original
+//code wrote as well; the last band of an aligned font stops above it
+static void slowGlyph(int x, int y, const SM16188FontGlyph &glyph, uint8_t height, bool aligned, byte bGraphicsMode)
+{
+    uint8_t bytes = (height + 7) / 8;
+    for (int j = 0; j < glyph.width; j++)
+    {
+        for (uint8_t i = 0; i < bytes; i++)
+        {
+            bool last = i == bytes - 1 && bytes > 1;
+            int offset = last && !aligned ? height - 8 : i * 8;
+            for (int k = 0; k < 8; k++)
+            {
+                int row = offset + k;
+                if (row < i * 8 || row > height || (last && aligned && row == height))
+                    continue;
+                slow.writePixel(x + j, y + row, bGraphicsMode, (glyph.data[i * glyph.width + j] >> k) & 1);
+            }
+        }
+    }
+}
+
+//Every glyph of font in every graphics mode at the 8 row offsets within a framebuffer byte,
+//unclipped and in a clip cutting through it
+static unsigned long checkFont(const char *name, const uint8_t *font, const SM16188FontSource &source)
+{
+    unsigned long cases = 0;
+    fast.selectFont(font);
+    uint8_t height = source.height;
+    for (size_t g = 0; g < source.glyphs.size(); g++)
+    {
+        const SM16188FontGlyph &glyph = source.glyphs[g];
+        if (glyph.code == ' ')
+            continue;
+        for (byte mode = 0; mode < 5; mode++)
+        {
+            for (int offset = 0; offset < 8; offset++)
+            {
+                for (int clip = 0; clip < 2; clip++)
+                {
+                    // from partly above the display to partly below it, and partly off either side
+                    int x = rand() % (pixelsWide + glyph.width) - glyph.width / 2;
+                    int y = 8 * (rand() % (pixelsHigh / 8 + 2) - 1) + offset;
+                    snprintf(drawn, sizeof(drawn), "%s glyph %u at %d, %d mode %d", name, glyph.code, x, y, mode);
+                    if (clip)
+                    {
+                        int clipX = x + rand() % (glyph.width + 2) - 1;
+                        int clipY = y + rand() % (height + 2) - 1;
+                        int w = rand() % (glyph.width + 1) + 1;
+                        int h = rand() % (height + 1) + 1;
+                        fast.pushClip(clipX, clipY, w, h);
+                        slow.pushClip(clipX, clipY, w, h);
+                        snprintf(drawn + strlen(drawn), sizeof(drawn) - strlen(drawn), " in clip %d,%d %dx%d", clipX, clipY, w, h);
+                        x -= clipX;
+                        y -= clipY;
+                    }
+                    fast.drawCodePoint(x, y, glyph.code, mode);
+                    slowGlyph(x, y, glyph, height, source.aligned, mode);
+                    endClip(clip);
+                    compare();
+                    cases++;
+                }
+            }
+        }
+    }
+    return cases;
+}
+
+//drawChar() and drawCodePoint(), which shift whole glyph column bytes into the framebuffer, in
+//the bundled fonts, rebuilt by sm16188BuildClassicFont() and in range table, RLE and aligned
+//versions of them
+static unsigned long checkGlyphs()
+{
+    const char *names[] = {"System5x7", "Arial_14", "Arial_Black_16"};
+    const uint8_t *fonts[] = {System5x7, Arial_14, Arial_Black_16};
+    unsigned long cases = 0;
+    for (int f = 0; f < 3; f++)
+    {
+        char name[40];
+        SM16188FontSource source = sm16188ReadFont(fonts[f]);
+        snprintf(name, sizeof(name), "%s", names[f]);
+        cases += checkFont(name, fonts[f], source);
+        std::vector<uint8_t> classic = sm16188BuildClassicFont(source);
+        snprintf(name, sizeof(name), "%s rebuilt", names[f]);
+        if (!classic.empty())
+            cases += checkFont(name, classic.data(), source);
+        for (int aligned = 0; aligned < 2; aligned++)
+        {
+            SM16188FontSource copy = sm16188CopyFont(source, 1, aligned);
+            for (int rle = 0; rle < 2; rle++)
+            {
+                std::vector<uint8_t> built = sm16188BuildFont(copy, rle);
+                snprintf(name, sizeof(name), "%s%s%s", names[f], aligned ? " aligned" : " ranges", rle ? " rle" : "");
+                cases += checkFont(name, built.data(), copy);
+            }
+        }
+    }
+    return cases;
+}
+
+//Glyph of a character in source, NULL for none; a space takes the place of an 'n', as in
+//codePointWidth()
+static const SM16188FontGlyph *slowGlyphOf(char c, const SM16188FontSource &source)
+{
+    for (size_t g = 0; g < source.glyphs.size(); g++)
+    {
+        if (source.glyphs[g].code == (uint8_t)(c == ' ' ? 'n' : c))
+            return &source.glyphs[g];
+    }
+    return NULL;
+}
+
+//Columns text takes in source, each glyph and the blank column after it as drawString() draws
+//them; characters without a glyph take none
+static int slowTextWidth(const char *text, const SM16188FontSource &source)
+{
+    int width = 0;
+    for (const char *c = text; *c; c++)
+    {
+        if (const SM16188FontGlyph *glyph = slowGlyphOf(*c, source))
+            width += glyph->width + 1;
+    }
+    return width;
+}
+
+//text drawn pixel by pixel from x,y on a clear display, as a marquee at that position
+static void slowMarquee(int x, int y, const char *text, const SM16188FontSource &source)
+{
+    slow.clearScreen(true);
+    for (const char *c = text; *c; c++)
+    {
+        const SM16188FontGlyph *glyph = slowGlyphOf(*c, source);
+        if (!glyph)
+            continue;
+        if (*c != ' ')
+            slowGlyph(x, y, *glyph, source.height, source.aligned, GRAPHICS_NORMAL);
+        x += glyph->width + 1;
+    }
+}
+
+//stepMarquee() by random steps, mostly the single columns it shifts the display for, through
+//several wraps around the display: after each the display must hold the text drawn pixel by
+//pixel at the marquee position, and it must report every wrap
+static unsigned long checkMarquee()
+{
+    const char *names[] = {"System5x7", "Arial_14", "Arial_Black_16 aligned rle"};
+    const uint8_t *fonts[] = {System5x7, Arial_14, Arial_Black_16};
+    const char *text = "Marquee 0123456789, quick brown fox";
+    const int steps[][2] = {{-1, 0}, {-1, 0}, {-1, 0}, {-1, 0}, {1, 0}, {1, 0}, {-3, 0}, {2, 0}, {0, 1}, {0, -1}, {-1, 1}};
+    unsigned long cases = 0;
+    for (int f = 0; f < 3; f++)
+    {
+        SM16188FontSource source = sm16188ReadFont(fonts[f]);
+        std::vector<uint8_t> built;
+        if (f == 2)
+        {
+            source = sm16188CopyFont(source, 1, true);
+            built = sm16188BuildFont(source, true);
+        }
+        fast.selectFont(f == 2 ? built.data() : fonts[f]);
+        int width = slowTextWidth(text, source);
+        int height = source.height;
+        for (int run = 0; run < 4; run++)
+        {
+            int x = rand() % pixelsWide;
+            int y = rand() % (pixelsHigh + height) - height;
+            fast.clearScreen(true);
+            fast.drawMarquee(text, strlen(text), x, y);
+            for (int n = 0; n < 2 * (pixelsWide + width); n++)
+            {
+                const int *step = steps[n % 64 < 48 ? 0 : rand() % (sizeof(steps) / sizeof(steps[0]))];
+                snprintf(drawn, sizeof(drawn), "%s marquee at %d, %d stepped by %d, %d", names[f], x, y, step[0], step[1]);
+                x += step[0];
+                y += step[1];
+                bool wrapped = x < -width || x > pixelsWide || y < -height || y > pixelsHigh;
+                if (x < -width)
+                    x = pixelsWide;
+                else if (x > pixelsWide)
+                    x = -width;
+                if (y < -height)
+                    y = pixelsHigh;
+                else if (y > pixelsHigh)
+                    y = -height;
+                if (fast.stepMarquee(step[0], step[1]) != wrapped)
+                {
+                    if (failures < 10)
+                        printf("  %s: stepMarquee() returned %s\n", drawn, wrapped ? "false" : "true");
+                    failures++;
+                }
+                slowMarquee(x, y, text, source);
+                unsigned long before = failures;
+                compare();
+                cases++;
+                if (failures != before)
+                {
+                    // compare() filled the display at random, start the marquee over from here
+                    fast.clearScreen(true);
+                    fast.drawMarquee(text, strlen(text), x, y);
+                }
+            }
+        }
+    }
+    return cases;
+}
+
+//Display refreshed with updateScreenStep() while a simulated timer interrupt calls
+//updateScreen(), and the number of times interrupts are enabled until it fires
+static Display timed;
+static unsigned long interruptCountdown;
+
+static void timerInterrupt()
+{
+    if (interruptCountdown && --interruptCountdown == 0)
+        timed.updateScreen();
+}
+
+//updateScreenStep() slices interrupted by updateScreen() at every point of the frame: each
+//frame sent must still be whole on both lines, its data bits and a 4 bit brightness
+static unsigned long checkRefresh()
+{
+    SM16188Host &host = SM16188Host::instance();
+    timed.begin(2, 1);
+    timed.setKeepAlive(0);
+    const unsigned long frameBits = 8 * (timed.txLineBytes() - 1) + 4;
+    const unsigned long cases = 2000;
+    host.clearTrace();
+    unsigned long frames = timed.framesSent();
+    host.interruptHandler = timerInterrupt;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        timed.writePixel(rand() % (2 * SM16188_PIXELS_ACROSS), rand() % SM16188_PIXELS_DOWN, GRAPHICS_TOGGLE, true);
+        unsigned int maxBytes = rand() % 8 + 1;
+        interruptCountdown = rand() % (2 * timed.txLineBytes() + 2) + 1;
+        snprintf(drawn, sizeof(drawn), "updateScreenStep(%u) interrupted after %lu locked runs", maxBytes, interruptCountdown);
+        while (!timed.updateScreenStep(maxBytes))
+        {
+        }
+        interruptCountdown = 0;
+        unsigned long sent = timed.framesSent() - frames;
+        if (host.pinPulses[1] != sent * frameBits || host.pinPulses[2] != sent * frameBits)
+        {
+            if (failures < 10)
+                printf("  %s: %lu bits on d1 and %lu on d2 for %lu frames of %lu bits\n", drawn, host.pinPulses[1],
+                       host.pinPulses[2], sent, frameBits);
+            failures++;
+            host.clearTrace();
+            frames = timed.framesSent();
+        }
+    }
+    host.interruptHandler = NULL;
+    return cases;
+}
+
+//Brightness on pin in one more refresh of timed, from the 4 bit trailer recorded
+static byte sentBrightness(uint8_t pin)
+{
+    SM16188Host &host = SM16188Host::instance();
+    host.clearTrace();
+    host.capture = true;
+    timed.invalidate();
+    timed.updateScreen();
+    host.capture = false;
+    std::vector<uint8_t> bits = host.bits(pin);
+    byte level = 0;
+    for (size_t k = bits.size() - 4; k < bits.size(); k++)
+        level = (level << 1) | bits[k];
+    return level;
+}
+
+//Brightness fades of every length up to SM16188_FADE_MAX_REFRESHES and beyond: each must
+//end on exactly its last refresh, at the level asked for, and setting that level again
+//must not send a frame
+static unsigned long checkFades()
+{
+    const unsigned long lengths[] = {1, 2, 3, 31, 32, 33, 255, 256, 8191, 8192, 8193, 60000, 65535, 65536, 100000};
+    const unsigned long cases = 200;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        unsigned long length = n < sizeof(lengths) / sizeof(lengths[0]) ? lengths[n] : rand() % 20000 + 1;
+        byte from = rand() % 16;
+        byte to = (from + 1 + rand() % 15) % 16;
+        timed.setBrightness(from, HALF_LOWER);
+        timed.fadeBrightness(to, length, HALF_LOWER);
+        snprintf(drawn, sizeof(drawn), "fadeBrightness(%d, %lu) from %d", to, length, from);
+        unsigned long refreshes = 0;
+        while (timed.fading() && refreshes <= length)
+        {
+            timed.updateScreen();
+            refreshes++;
+        }
+        unsigned long expected = length < SM16188_FADE_MAX_REFRESHES ? length : SM16188_FADE_MAX_REFRESHES;
+        byte level = sentBrightness(2);
+        // setting the level it ended on must not send another frame
+        unsigned long frames = timed.framesSent();
+        timed.setBrightness(to, HALF_LOWER);
+        timed.updateScreen();
+        bool resent = timed.framesSent() != frames;
+        if (refreshes != expected || level != to || resent)
+        {
+            if (failures < 10)
+                printf("  %s: ended after %lu refreshes at level %d%s\n", drawn, refreshes, level,
+                       resent ? ", setting that level again sent a frame" : "");
+            failures++;
+        }
+    }
+    SM16188Host::instance().clearTrace();
+    return cases;
+}
+
+//Grayscale display, refreshed with the pulses recorded and decoded back into frames
+static Display gray;
+
+//Random gray levels at 2 to 4 bits, refreshed for two cycles of 2^bits - 1 refreshes: the
+//decoded frame on the panels at each refresh must set every pixel for exactly twice its level,
+//and each cycle must send one frame per plane
+static unsigned long checkGrayscale()
+{
+    SM16188Host &host = SM16188Host::instance();
+    const int wide = 2;
+    const int high = 2;
+    const int grayWide = SM16188_PIXELS_ACROSS * wide;
+    const int grayHigh = SM16188_PIXELS_DOWN * high;
+    gray.begin(wide, high);
+    gray.setKeepAlive(0);
+    SM16188WaveLimits limits = sm16188WaveDatasheet();
+    limits.panels = wide * high;
+    std::vector<SM16188WavePanel> chain;
+    std::string error;
+    sm16188WaveChain("0,0 1,0 0,1 1,1", wide, high, chain, error);
+    unsigned long cases = 0;
+    for (byte bits = 2; bits <= 4; bits++)
+    {
+        for (int image = 0; image < 4; image++)
+        {
+            const int cycle = (1 << bits) - 1;
+            gray.setGrayscale(bits);
+            std::vector<byte> levels(grayWide * grayHigh);
+            for (int x = 0; x < grayWide; x++)
+            {
+                for (int y = 0; y < grayHigh; y++)
+                {
+                    levels[x * grayHigh + y] = rand() % (cycle + 1);
+                    gray.writePixelGray(x, y, levels[x * grayHigh + y]);
+                }
+            }
+            // frames sent by the end of each refresh
+            std::vector<unsigned long> sentBy(2 * cycle);
+            unsigned long frames = gray.framesSent();
+            host.clearTrace();
+            host.capture = true;
+            for (int refresh = 0; refresh < 2 * cycle; refresh++)
+            {
+                gray.updateScreen();
+                host.idle(SM16188_TRST_US * 1000UL + 10000);
+                sentBy[refresh] = gray.framesSent() - frames;
+            }
+            host.capture = false;
+            SM16188WaveLine d1 = sm16188DecodeLine(sm16188HostPulses(host.trace, 1, host.nowNs), limits);
+            SM16188WaveLine d2 = sm16188DecodeLine(sm16188HostPulses(host.trace, 2, host.nowNs), limits);
+            host.clearTrace();
+
+            std::vector<std::vector<uint8_t> > decoded(sentBy.back());
+            bool whole = d1.frames.size() == sentBy.back() && d2.frames.size() == sentBy.back();
+            for (size_t f = 0; whole && f < decoded.size(); f++)
+                whole = sm16188WaveFramebuffer(d1.frames[f], d2.frames[f], wide, high, chain, decoded[f]);
+            snprintf(drawn, sizeof(drawn), "setGrayscale(%d) image %d", bits, image);
+            cases += grayWide * grayHigh;
+            if (!whole || sentBy.back() - sentBy[cycle - 1] != bits)
+            {
+                printf("  %s: %lu frames sent, %lu in the second cycle, %lu and %lu decoded\n", drawn,
+                       sentBy.back(), sentBy.back() - sentBy[cycle - 1], (unsigned long)d1.frames.size(),
+                       (unsigned long)d2.frames.size());
+                failures += grayWide * grayHigh;
+                continue;
+            }
+            for (int x = 0; x < grayWide; x++)
+            {
+                for (int y = 0; y < grayHigh; y++)
+                {
+                    int set = 0;
+                    for (int refresh = 0; refresh < 2 * cycle; refresh++)
+                        set += (decoded[sentBy[refresh] - 1][x * 2 * high + y / 8] >> (y & 7)) & 1;
+                    if (set != 2 * levels[x * grayHigh + y])
+                    {
+                        if (failures < 10)
+                            printf("  %s: pixel %d,%d at level %d set for %d of %d refreshes\n", drawn, x, y,
+                                   levels[x * grayHigh + y], set, 2 * cycle);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    gray.setGrayscale(1);
+    return cases;
+}
+
+//Double buffered display, swapped while updateScreenStep() is sending a frame
+static Display swapped;
+
+//Draw a random frame into the back buffer of swapped and return a copy of it
+static std::vector<uint8_t> drawSwapped()
+{
+    for (int x = 0; x < 2 * SM16188_PIXELS_ACROSS; x++)
+    {
+        for (int y = 0; y < SM16188_PIXELS_DOWN; y++)
+            swapped.writePixel(x, y, GRAPHICS_NORMAL, rand() & 1);
+    }
+    return std::vector<uint8_t>(swapped.frameBuffer(), swapped.frameBuffer() + 2 * SM16188_RAM_SIZE_BYTES);
+}
+
+//swapBuffers() at every point of a frame in flight, then drawing over the new back buffer:
+//the frame in flight must still arrive as it was shown, and the next one as swapped in
+static unsigned long checkSwap()
+{
+    SM16188Host &host = SM16188Host::instance();
+    swapped.begin(2, 1, true);
+    swapped.setKeepAlive(0);
+    SM16188WaveLimits limits = sm16188WaveDatasheet();
+    limits.panels = 2;
+    std::vector<SM16188WavePanel> chain;
+    std::string error;
+    sm16188WaveChain("0,0 1,0", 2, 1, chain, error);
+    const unsigned long cases = 200;
+    for (unsigned long n = 0; n < cases; n++)
+    {
+        std::vector<uint8_t> shown = drawSwapped();
+        swapped.swapBuffers();
+        std::vector<uint8_t> next = drawSwapped();
+        unsigned int maxBytes = rand() % (2 * swapped.txLineBytes()) + 1;
+        bool copyFrame = rand() & 1;
+        snprintf(drawn, sizeof(drawn), "swapBuffers(%s) after updateScreenStep(%u)", copyFrame ? "true" : "false", maxBytes);
+
+        host.clearTrace();
+        host.capture = true;
+        bool done = swapped.updateScreenStep(maxBytes);
+        swapped.swapBuffers(copyFrame);
+        drawSwapped();
+        if (done)
+            host.idle(SM16188_TRST_US * 1000UL + 10000);
+        while (!swapped.updateScreenStep(8))
+        {
+        }
+        host.idle(SM16188_TRST_US * 1000UL + 10000);
+        swapped.updateScreen();
+        host.idle(SM16188_TRST_US * 1000UL + 10000);
+        host.capture = false;
+        SM16188WaveLine d1 = sm16188DecodeLine(sm16188HostPulses(host.trace, 1, host.nowNs), limits);
+        SM16188WaveLine d2 = sm16188DecodeLine(sm16188HostPulses(host.trace, 2, host.nowNs), limits);
+        host.clearTrace();
+
+        std::vector<uint8_t> first, second;
+        bool whole = d1.frames.size() == 2 && d2.frames.size() == 2 &&
+                     sm16188WaveFramebuffer(d1.frames[0], d2.frames[0], 2, 1, chain, first) &&
+                     sm16188WaveFramebuffer(d1.frames[1], d2.frames[1], 2, 1, chain, second);
+        if (!whole || first != shown || second != next)
+        {
+            if (failures < 10)
+                printf("  %s: %lu and %lu frames, %s\n", drawn, (unsigned long)d1.frames.size(), (unsigned long)d2.frames.size(),
+                       !whole ? "not whole" : first != shown ? "the frame in flight changed" : "the swapped frame differs");
+            failures++;
+        }
+    }
+    return cases;
+}
+
+//Run a section from a random frame, false if any of its cases differed
+static bool section(const char *name, unsigned long (*run)())
+{
+    failures = 0;
+    randomFill();
+    unsigned long cases = run();
+    if (failures)
+        printf("%s: %lu of %lu cases differ\n", name, failures, cases);
+    else
+        printf("%s: %lu cases ok\n", name, cases);
+    return failures == 0;
+}
+
+int main()
+{
+    srand(16188);
+    if (!fast.begin(CHECK_WIDE, CHECK_HIGH) || !slow.begin(CHECK_WIDE, CHECK_HIGH))
+    {
+        fprintf(stderr, "sm16188_check: out of memory\n");
+        return 1;
+    }
+    bool ok = section("spans", checkSpans);
+    ok &= section("bitmaps", checkBitmaps);
+    ok &= section("shapes", checkShapes);
+    ok &= section("glyphs", checkGlyphs);
+    ok &= section("marquee", checkMarquee);
+    ok &= section("refresh", checkRefresh);
+    ok &= section("fades", checkFades);
+    ok &= section("grayscale", checkGrayscale);
+    ok &= section("swap", checkSwap);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_font.h - Host side font building for the sm16188 library.
+
+ Reads the classic fonts of fonts/ and builds fonts with a range table (see
+ FONT_RANGE_TABLE in sm16188.h), optionally with FONT_FLAG_RLE compressed glyph data, or
+ in the classic layout.
+ Used by the benchmarks and the font tools.
+--------------------------------------------------------------------------------------*/
+
+#ifndef SM16188_FONT_H_
+#define SM16188_FONT_H_
+
+#include <sm16188.h>
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+//One glyph of a font being built
+struct SM16188FontGlyph
+{
+    uint16_t code;             //Unicode code point
+    uint8_t width;             //columns
+    std::vector<uint8_t> data; //column bytes of each band of 8 rows in turn, as drawChar() reads them
+};
+
+//A font being built, glyphs sorted by code point
+struct SM16188FontSource
+{
+    uint8_t height;
+    bool aligned; //bands start at every 8th row, see FONT_FLAG_ALIGNED
+    std::vector<SM16188FontGlyph> glyphs;
+};
+
+//Bands of 8 rows holding row y of a glyph: y / 8, and unless aligned the last band, which
+//is aligned to the bottom of the glyph and overlaps the one above when the height is not a
+//multiple of 8
+inline bool sm16188GlyphBand(uint8_t height, bool aligned, uint8_t band, int y, int &bit)
+{
+    uint8_t bytes = (height + 7) / 8;
+    int offset = band == bytes - 1 && bytes > 1 && !aligned ? height - 8 : band * 8;
+    bit = y - offset;
+    return bit >= 0 && bit < 8;
+}
+
+//Pixel x,y of a glyph
+inline bool sm16188GlyphPixel(const SM16188FontGlyph &glyph, uint8_t height, bool aligned, int x, int y)
+{
+    int bit;
+    uint8_t band = y / 8 < (height + 7) / 8 ? y / 8 : (height + 7) / 8 - 1;
+    sm16188GlyphBand(height, aligned, band, y, bit);
+    return (glyph.data[band * glyph.width + x] >> bit) & 1;
+}
+
+//Set pixel x,y of a glyph whose data is sized for its width and height
+inline void sm16188SetGlyphPixel(SM16188FontGlyph &glyph, uint8_t height, bool aligned, int x, int y)
+{
+    int bit;
+    for (uint8_t band = 0; band < (height + 7) / 8; band++)
+    {
+        if (sm16188GlyphBand(height, aligned, band, y, bit))
+            glyph.data[band * glyph.width + x] |= 1 << bit;
+    }
+}
+
+//Glyphs of a classic font, one run of 8 bit characters with fixed or variable width.
+//Glyphs of width 0 are left out, drawChar() treats them as missing anyway.
+inline SM16188FontSource sm16188ReadFont(const uint8_t *font)
+{
+    SM16188FontSource source;
+    source.height = font[FONT_HEIGHT];
+    source.aligned = false;
+    uint8_t bytes = (source.height + 7) / 8;
+    uint8_t first = font[FONT_FIRST_CHAR];
+    uint8_t count = font[FONT_CHAR_COUNT];
+    bool fixed = font[FONT_LENGTH] == 0 && font[FONT_LENGTH + 1] == 0;
+
+    const uint8_t *data = font + FONT_WIDTH_TABLE + (fixed ? 0 : count);
+    for (uint16_t c = 0; c < count; c++)
+    {
+        SM16188FontGlyph glyph;
+        glyph.code = first + c;
+        glyph.width = fixed ? font[FONT_FIXED_WIDTH] : font[FONT_WIDTH_TABLE + c];
+        glyph.data.assign(data, data + glyph.width * bytes);
+        data += glyph.width * bytes;
+        if (glyph.width)
+            source.glyphs.push_back(glyph);
+    }
+    return source;
+}
+
+//Every glyph of a font scaled up by scale, with its bands laid out as aligned says
+inline SM16188FontSource sm16188CopyFont(const SM16188FontSource &source, int scale, bool aligned)
+{
+    SM16188FontSource copy;
+    copy.height = source.height * scale;
+    copy.aligned = aligned;
+    for (size_t g = 0; g < source.glyphs.size(); g++)
+    {
+        const SM16188FontGlyph &glyph = source.glyphs[g];
+        SM16188FontGlyph big;
+        big.code = glyph.code;
+        big.width = glyph.width * scale;
+        big.data.assign(big.width * ((copy.height + 7) / 8), 0);
+        for (int x = 0; x < big.width; x++)
+        {
+            for (int y = 0; y < copy.height; y++)
+            {
+                if (sm16188GlyphPixel(glyph, source.height, source.aligned, x / scale, y / scale))
+                    sm16188SetGlyphPixel(big, copy.height, aligned, x, y);
+            }
+        }
+        copy.glyphs.push_back(big);
+    }
+    return copy;
+}
+
+//Compress data as SM16188RleReader reads it, choosing the shortest split into zero runs,
+//repeated bytes and literal bytes
+inline std::vector<uint8_t> sm16188Rle(const std::vector<uint8_t> &data)
+{
+    // cost[i] is the size of the best encoding of data from i on, run[i] its first run
+    // (negative for a literal run)
+    size_t n = data.size();
+    std::vector<size_t> cost(n + 1, 0);
+    std::vector<int> run(n + 1, 0);
+    for (size_t i = n; i-- > 0;)
+    {
+        cost[i] = (size_t)-1;
+        for (size_t length = 1; length <= 128 && i + length <= n; length++)
+        {
+            if (1 + length + cost[i + length] < cost[i])
+            {
+                cost[i] = 1 + length + cost[i + length];
+                run[i] = -(int)length;
+            }
+        }
+        size_t same = 1;
+        while (i + same < n && data[i + same] == data[i] && same < 65)
+            same++;
+        for (size_t length = data[i] ? 2 : 1; length <= same && length <= (data[i] ? 65u : 64u); length++)
+        {
+            size_t size = (data[i] ? 2 : 1) + cost[i + length];
+            if (size < cost[i])
+            {
+                cost[i] = size;
+                run[i] = length;
+            }
+        }
+    }
+
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < n;)
+    {
+        if (run[i] < 0)
+        {
+            out.push_back(-run[i] - 1);
+            out.insert(out.end(), data.begin() + i, data.begin() + i - run[i]);
+            i -= run[i];
+        }
+        else
+        {
+            if (data[i])
+            {
+                out.push_back(0x80 | (run[i] - 2));
+                out.push_back(data[i]);
+            }
+            else
+            {
+                out.push_back(0xC0 | (run[i] - 1));
+            }
+            i += run[i];
+        }
+    }
+    return out;
+}
+
+inline void sm16188PutWord(std::vector<uint8_t> &out, size_t at, uint16_t value)
+{
+    out[at] = value & 0xFF;
+    out[at + 1] = value >> 8;
+}
+
+//Build a font with a range table from source. With rle set, every glyph is RLE compressed
+//where that makes it shorter and the offsets are indexed by block, see FONT_RLE_BLOCK;
+//otherwise glyphs with the same data share it. Returns an empty font when it would need more
+//than 255 ranges or 64 KB.
+inline std::vector<uint8_t> sm16188BuildFont(const SM16188FontSource &source, bool rle)
+{
+    const std::vector<SM16188FontGlyph> &glyphs = source.glyphs;
+    std::vector<uint8_t> font;
+    if (glyphs.empty())
+        return font;
+
+    // consecutive code points share a range
+    std::vector<size_t> rangeStarts;
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        if (g == 0 || glyphs[g].code != glyphs[g - 1].code + 1)
+            rangeStarts.push_back(g);
+    }
+    if (rangeStarts.size() > 255 || glyphs.size() > 0xFFFF)
+        return font;
+
+    uint8_t fixedWidth = glyphs[0].width;
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        if (glyphs[g].width != fixedWidth)
+            fixedWidth = 0;
+    }
+
+    size_t widths = FONT_RANGE_TABLE + rangeStarts.size() * FONT_RANGE_SIZE;
+    size_t offsets = widths + glyphs.size();
+    size_t blocks = (glyphs.size() + FONT_RLE_BLOCK - 1) / FONT_RLE_BLOCK;
+    size_t sizes = offsets + 2 * blocks;
+    font.resize(rle ? sizes + glyphs.size() : offsets + 2 * glyphs.size());
+    font[FONT_FIXED_WIDTH] = fixedWidth;
+    font[FONT_HEIGHT] = source.height;
+    font[FONT_FIRST_CHAR] = 0;
+    font[FONT_CHAR_COUNT] = 0;
+    font[FONT_FLAGS] = (rle ? FONT_FLAG_RLE : 0) | (source.aligned ? FONT_FLAG_ALIGNED : 0);
+    font[FONT_RANGE_COUNT] = rangeStarts.size();
+    sm16188PutWord(font, FONT_GLYPH_COUNT, glyphs.size());
+    for (size_t r = 0; r < rangeStarts.size(); r++)
+    {
+        size_t start = rangeStarts[r];
+        size_t end = r + 1 < rangeStarts.size() ? rangeStarts[r + 1] : glyphs.size();
+        size_t at = FONT_RANGE_TABLE + r * FONT_RANGE_SIZE;
+        sm16188PutWord(font, at, glyphs[start].code);
+        sm16188PutWord(font, at + 2, end - start);
+        sm16188PutWord(font, at + 4, start);
+    }
+
+    std::map<std::vector<uint8_t>, size_t> written;
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        if (font.size() > 0xFFFF)
+            return std::vector<uint8_t>();
+        font[widths + g] = glyphs[g].width;
+        if (rle)
+        {
+            if (g % FONT_RLE_BLOCK == 0)
+                sm16188PutWord(font, offsets + 2 * (g / FONT_RLE_BLOCK), font.size());
+            std::vector<uint8_t> data = sm16188Rle(glyphs[g].data);
+            if (data.size() < glyphs[g].data.size() && data.size() <= 255)
+                font[sizes + g] = data.size();
+            else
+                data = glyphs[g].data;
+            font.insert(font.end(), data.begin(), data.end());
+            continue;
+        }
+        const std::vector<uint8_t> &data = glyphs[g].data;
+        std::map<std::vector<uint8_t>, size_t>::iterator same = written.find(data);
+        if (same != written.end())
+        {
+            sm16188PutWord(font, offsets + 2 * g, same->second);
+            continue;
+        }
+        written[data] = font.size();
+        sm16188PutWord(font, offsets + 2 * g, font.size());
+        font.insert(font.end(), data.begin(), data.end());
+    }
+    if (font.size() > 0xFFFF)
+        return std::vector<uint8_t>();
+
+    // big-endian, as in the classic fonts
+    font[FONT_LENGTH] = font.size() >> 8;
+    font[FONT_LENGTH + 1] = font.size() & 0xFF;
+    return font;
+}
+
+//Build a font in the classic layout of fonts/ from source, fixed width when every code point
+//from the first to the last has a glyph of the same width. Returns an empty font when the
+//classic layout would read the glyphs differently: code points beyond ASCII, which fonts
+//with a range table take from UTF-8 and classic ones from single bytes, or aligned bands
+//that differ from the overlapping ones of the classic layout.
+inline std::vector<uint8_t> sm16188BuildClassicFont(const SM16188FontSource &source)
+{
+    const std::vector<SM16188FontGlyph> &glyphs = source.glyphs;
+    std::vector<uint8_t> font;
+    if (glyphs.empty() || glyphs.back().code >= 0x80 || (source.aligned && source.height > 8 && source.height % 8))
+        return font;
+
+    uint8_t first = glyphs[0].code;
+    uint8_t count = glyphs.back().code - first + 1;
+    uint8_t widest = 0;
+    bool fixed = glyphs.size() == count;
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        widest = glyphs[g].width > widest ? glyphs[g].width : widest;
+        fixed &= glyphs[g].width == glyphs[0].width;
+    }
+
+    font.resize(FONT_WIDTH_TABLE + (fixed ? 0 : count));
+    font[FONT_FIXED_WIDTH] = widest;
+    font[FONT_HEIGHT] = source.height;
+    font[FONT_FIRST_CHAR] = first;
+    font[FONT_CHAR_COUNT] = count;
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        if (!fixed)
+            font[FONT_WIDTH_TABLE + glyphs[g].code - first] = glyphs[g].width;
+        font.insert(font.end(), glyphs[g].data.begin(), glyphs[g].data.end());
+    }
+
+    // a size of 0 marks a fixed width font, big-endian otherwise
+    if (!fixed)
+    {
+        font[FONT_LENGTH] = font.size() >> 8;
+        font[FONT_LENGTH + 1] = font.size() & 0xFF;
+    }
+    return font;
+}
+
+//Offset of the data of every glyph of a font built by sm16188BuildFont(), and whether it is
+//compressed. Returns where the glyph data start.
+inline size_t sm16188GlyphOffsets(const std::vector<uint8_t> &font, std::vector<size_t> &offsets, std::vector<bool> &compressed)
+{
+    size_t glyphs = font[FONT_GLYPH_COUNT] | (font[FONT_GLYPH_COUNT + 1] << 8);
+    size_t widths = FONT_RANGE_TABLE + font[FONT_RANGE_COUNT] * FONT_RANGE_SIZE;
+    size_t index = widths + glyphs;
+    uint8_t bytes = (font[FONT_HEIGHT] + 7) / 8;
+    offsets.resize(glyphs);
+    compressed.assign(glyphs, false);
+    if (!(font[FONT_FLAGS] & FONT_FLAG_RLE))
+    {
+        for (size_t g = 0; g < glyphs; g++)
+            offsets[g] = font[index + 2 * g] | (font[index + 2 * g + 1] << 8);
+        return index + 2 * glyphs;
+    }
+    size_t sizes = index + 2 * ((glyphs + FONT_RLE_BLOCK - 1) / FONT_RLE_BLOCK);
+    for (size_t g = 0; g < glyphs; g++)
+    {
+        if (g % FONT_RLE_BLOCK == 0)
+            offsets[g] = font[index + 2 * (g / FONT_RLE_BLOCK)] | (font[index + 2 * (g / FONT_RLE_BLOCK) + 1] << 8);
+        else
+            offsets[g] = offsets[g - 1] + (font[sizes + g - 1] ? font[sizes + g - 1] : bytes * font[widths + g - 1]);
+        compressed[g] = font[sizes + g] != 0;
+    }
+    return sizes + glyphs;
+}
+
+#endif /* SM16188_FONT_H_ */
@@ -0,0 +1,410 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_fontc.cpp - Font compiler for the sm16188 library.
+
+ Turns a BDF bitmap font into a header for fonts/ with a range table (see FONT_RANGE_TABLE
+ in sm16188.h): glyph offsets precomputed, only the Unicode ranges asked for, bands of
+ 8 rows aligned to the framebuffer bytes and optionally RLE compressed glyphs. An ASCII
+ font whose classic layout is no larger is written in that instead, unless -t is given.
+ Outline fonts are rasterized to BDF first, for example with otf2bdf.
+
+ Usage:  sm16188_fontc [-n name] [-r ranges] [-c] [-o] [-t] font.bdf > font.h
+
+   -n name    name of the font array, from the file name by default
+   -r ranges  code points to include, such as 32-126,0x410-0x44F (default all up to U+FFFF)
+   -c         RLE compress the glyph data (FONT_FLAG_RLE)
+   -o         overlap the last band with the one above as the classic fonts do,
+              instead of FONT_FLAG_ALIGNED bands
+   -t         always write a range table, even where the classic layout is smaller
+
+ Glyph widths are the BDF DWIDTH less the blank column drawString() adds after every
+ character, widened to any ink beyond it.
+--------------------------------------------------------------------------------------*/
+
+#include <sm16188.h>
+#include <sm16188_font.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+struct Range
+{
+    long first;
+    long last;
+};
+
+static bool parseRanges(const char *text, std::vector<Range> &ranges)
+{
+    while (*text)
+    {
+        char *end;
+        Range range;
+        range.first = strtol(text, &end, 0);
+        if (end == text)
+            return false;
+        range.last = range.first;
+        text = end;
+        if (*text == '-')
+        {
+            range.last = strtol(++text, &end, 0);
+            if (end == text || range.last < range.first)
+                return false;
+            text = end;
+        }
+        ranges.push_back(range);
+        if (*text == ',')
+            text++;
+        else if (*text)
+            return false;
+    }
+    return true;
+}
+
+static bool wanted(const std::vector<Range> &ranges, long code)
+{
+    if (code < 0 || code > 0xFFFF)
+        return false;
+    if (ranges.empty())
+        return true;
+    for (size_t r = 0; r < ranges.size(); r++)
+    {
+        if (code >= ranges[r].first && code <= ranges[r].last)
+            return true;
+    }
+    return false;
+}
+
+static bool byCode(const SM16188FontGlyph &a, const SM16188FontGlyph &b)
+{
+    return a.code < b.code;
+}
+
+//Read the glyphs of a BDF font, returns false with a message on errors
+static bool readBdf(FILE *in, const std::vector<Range> &ranges, SM16188FontSource &source, std::string &error)
+{
+    char line[1024];
+    int ascent = -1;
+    int descent = -1;
+    int boxHeight = 0;
+    int boxY = 0;
+    std::vector<SM16188FontGlyph> glyphs;
+
+    long code = -1;
+    int advance = 0;
+    int w = 0, h = 0, xo = 0, yo = 0;
+    while (fgets(line, sizeof(line), in))
+    {
+        if (sscanf(line, "FONTBOUNDINGBOX %*d %d %*d %d", &boxHeight, &boxY) == 2)
+            continue;
+        if (sscanf(line, "FONT_ASCENT %d", &ascent) == 1 || sscanf(line, "FONT_DESCENT %d", &descent) == 1)
+            continue;
+        if (strncmp(line, "STARTCHAR", 9) == 0)
+        {
+            code = -1;
+            advance = w = h = xo = yo = 0;
+            continue;
+        }
+        if (sscanf(line, "ENCODING %ld", &code) == 1 || sscanf(line, "DWIDTH %d", &advance) == 1 ||
+            sscanf(line, "BBX %d %d %d %d", &w, &h, &xo, &yo) == 4)
+            continue;
+        if (strncmp(line, "BITMAP", 6) != 0)
+            continue;
+
+        // bitmap rows follow, top row first, up to ENDCHAR
+        if (ascent < 0 || descent < 0)
+        {
+            ascent = boxHeight + boxY;
+            descent = -boxY;
+        }
+        if (ascent + descent <= 0 || ascent + descent > 255)
+        {
+            error = "font height out of range";
+            return false;
+        }
+        source.height = ascent + descent;
+
+        SM16188FontGlyph glyph;
+        glyph.code = code;
+        int width = std::max(advance - 1, xo + w);
+        glyph.width = std::min(std::max(width, 1), 255);
+        glyph.data.assign(glyph.width * ((source.height + 7) / 8), 0);
+        for (int row = 0; fgets(line, sizeof(line), in) && strncmp(line, "ENDCHAR", 7) != 0; row++)
+        {
+            int y = ascent - (yo + h) + row;
+            for (int x = 0; x < w && isxdigit((unsigned char)line[x / 4]); x++)
+            {
+                char digit[2] = {line[x / 4], 0};
+                bool set = (strtol(digit, NULL, 16) >> (3 - x % 4)) & 1;
+                if (set && xo + x >= 0 && xo + x < glyph.width && y >= 0 && y < source.height)
+                    sm16188SetGlyphPixel(glyph, source.height, source.aligned, xo + x, y);
+            }
+        }
+        if (wanted(ranges, code))
+            glyphs.push_back(glyph);
+    }
+
+    // first glyph of every code point, in code point order
+    std::stable_sort(glyphs.begin(), glyphs.end(), byCode);
+    for (size_t g = 0; g < glyphs.size(); g++)
+    {
+        if (g == 0 || glyphs[g].code != glyphs[g - 1].code)
+            source.glyphs.push_back(glyphs[g]);
+    }
+    if (source.glyphs.empty())
+    {
+        error = "no glyphs in the ranges asked for";
+        return false;
+    }
+    return true;
+}
+
+static void printBytes(const std::vector<uint8_t> &font, size_t from, size_t to, const char *comment)
+{
+    printf("    ");
+    for (size_t i = from; i < to; i++)
+        printf("0x%02X, ", font[i]);
+    if (comment)
+        printf("// %s", comment);
+    printf("\n");
+}
+
+static uint16_t word(const std::vector<uint8_t> &font, size_t at)
+{
+    return font[at] | (font[at + 1] << 8);
+}
+
+//Write the top of a font header, up to the opening of the array
+static void writeHead(const char *name, const char *file, const SM16188FontSource &source, const std::vector<uint8_t> &font)
+{
+    std::string guard;
+    for (const char *c = name; *c; c++)
+        guard += isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+    uint8_t widest = 0;
+    for (size_t g = 0; g < source.glyphs.size(); g++)
+        widest = std::max(widest, source.glyphs[g].width);
+    bool ranges = font[FONT_FIRST_CHAR] == 0 && font[FONT_CHAR_COUNT] == 0;
+
+    printf("/*\n *\n * %s\n *\n * generated by sm16188_fontc from %s\n *\n", name, file);
+    printf(" * Font size in bytes  : %zu\n", font.size());
+    printf(" * Font width          : %u\n", widest);
+    printf(" * Font height         : %u\n", source.height);
+    if (ranges)
+    {
+        printf(" * Font glyphs         : %u in %u ranges\n", word(font, FONT_GLYPH_COUNT), font[FONT_RANGE_COUNT]);
+        printf(" * Font flags          :%s%s\n", font[FONT_FLAGS] & FONT_FLAG_RLE ? " RLE" : "",
+               font[FONT_FLAGS] & FONT_FLAG_ALIGNED ? " aligned" : "");
+        printf(" *\n * The font data are laid out as described at FONT_RANGE_TABLE in sm16188.h\n */\n\n");
+    }
+    else
+    {
+        printf(" * Font first char     : %u\n", font[FONT_FIRST_CHAR]);
+        printf(" * Font char count     : %u\n", font[FONT_CHAR_COUNT]);
+        printf(" *\n * The font data are laid out as in the classic fonts of fonts/, %s width\n */\n\n",
+               font[FONT_LENGTH] || font[FONT_LENGTH + 1] ? "variable" : "fixed");
+    }
+    printf("#include <inttypes.h>\n#ifdef __AVR__\n#include <avr/pgmspace.h>\n#endif\n\n");
+    printf("#ifndef %s_H\n#define %s_H\n\n", guard.c_str(), guard.c_str());
+    printf("#define %s_WIDTH %u\n#define %s_HEIGHT %u\n\n", guard.c_str(), widest, guard.c_str(), source.height);
+    printf("const static uint8_t %s[] PROGMEM = {\n", name);
+}
+
+//Comment naming the glyph of a code point
+static const char *glyphComment(char *comment, size_t size, uint16_t code, bool packed)
+{
+    if (code >= 0x21 && code < 0x7F)
+        snprintf(comment, size, "U+%04X '%c'%s", code, code, packed ? " RLE" : "");
+    else
+        snprintf(comment, size, "U+%04X%s", code, packed ? " RLE" : "");
+    return comment;
+}
+
+//Write a font built by sm16188BuildClassicFont() as a header
+static void writeClassicHeader(const char *name, const char *file, const SM16188FontSource &source, const std::vector<uint8_t> &font)
+{
+    bool fixed = !font[FONT_LENGTH] && !font[FONT_LENGTH + 1];
+    size_t data = FONT_WIDTH_TABLE + (fixed ? 0 : font[FONT_CHAR_COUNT]);
+    writeHead(name, file, source, font);
+    printBytes(font, FONT_LENGTH, FONT_LENGTH + 2, fixed ? "size, 0 for a fixed width font" : "size");
+    printBytes(font, FONT_FIXED_WIDTH, FONT_FIXED_WIDTH + 1, "width");
+    printBytes(font, FONT_HEIGHT, FONT_HEIGHT + 1, "height");
+    printBytes(font, FONT_FIRST_CHAR, FONT_FIRST_CHAR + 1, "first char");
+    printBytes(font, FONT_CHAR_COUNT, FONT_CHAR_COUNT + 1, "char count");
+    if (!fixed)
+    {
+        printf("    \n    // char widths, 0 for missing chars\n");
+        for (size_t at = FONT_WIDTH_TABLE; at < data; at += 10)
+            printBytes(font, at, std::min(at + 10, data), NULL);
+    }
+    printf("    \n    // font data\n");
+    size_t at = data;
+    for (size_t g = 0; g < source.glyphs.size(); g++)
+    {
+        char comment[24];
+        size_t end = at + source.glyphs[g].data.size();
+        printBytes(font, at, end, glyphComment(comment, sizeof(comment), source.glyphs[g].code, false));
+        at = end;
+    }
+    printf("};\n\n#endif\n");
+}
+
+//Write font as a header in the layout of the bundled fonts
+static void writeHeader(const char *name, const char *file, const SM16188FontSource &source, const std::vector<uint8_t> &font)
+{
+    uint8_t ranges = font[FONT_RANGE_COUNT];
+    uint16_t glyphs = word(font, FONT_GLYPH_COUNT);
+    size_t widths = FONT_RANGE_TABLE + ranges * FONT_RANGE_SIZE;
+    size_t offsets = widths + glyphs;
+    std::vector<size_t> glyphOffsets;
+    std::vector<bool> compressed;
+    size_t data = sm16188GlyphOffsets(font, glyphOffsets, compressed);
+    bool rle = font[FONT_FLAGS] & FONT_FLAG_RLE;
+    size_t sizes = rle ? data - glyphs : data;
+
+    writeHead(name, file, source, font);
+    printBytes(font, FONT_LENGTH, FONT_LENGTH + 2, "size");
+    printBytes(font, FONT_FIXED_WIDTH, FONT_FIXED_WIDTH + 1, "width");
+    printBytes(font, FONT_HEIGHT, FONT_HEIGHT + 1, "height");
+    printBytes(font, FONT_FIRST_CHAR, FONT_FIRST_CHAR + 1, "first char, 0 for a range table");
+    printBytes(font, FONT_CHAR_COUNT, FONT_CHAR_COUNT + 1, "char count, 0 for a range table");
+    printBytes(font, FONT_FLAGS, FONT_FLAGS + 1, "flags");
+    printBytes(font, FONT_RANGE_COUNT, FONT_RANGE_COUNT + 1, "range count");
+    printBytes(font, FONT_GLYPH_COUNT, FONT_GLYPH_COUNT + 2, "glyph count");
+
+    printf("    \n    // ranges: first code point, count, first glyph\n");
+    for (uint8_t r = 0; r < ranges; r++)
+    {
+        size_t at = FONT_RANGE_TABLE + r * FONT_RANGE_SIZE;
+        char comment[32];
+        snprintf(comment, sizeof(comment), "U+%04X-U+%04X", word(font, at), word(font, at) + word(font, at + 2) - 1);
+        printBytes(font, at, at + FONT_RANGE_SIZE, comment);
+    }
+    printf("    \n    // glyph widths\n");
+    for (size_t at = widths; at < offsets; at += 10)
+        printBytes(font, at, std::min(at + 10, offsets), NULL);
+    printf("    \n    // glyph offsets%s\n", rle ? ", one per block of FONT_RLE_BLOCK glyphs" : "");
+    for (size_t at = offsets; at < sizes; at += 16)
+        printBytes(font, at, std::min(at + 16, sizes), NULL);
+    if (rle)
+    {
+        printf("    \n    // compressed glyph sizes, 0 for glyphs stored uncompressed\n");
+        for (size_t at = sizes; at < data; at += 16)
+            printBytes(font, at, std::min(at + 16, data), NULL);
+    }
+
+    // data of every distinct glyph, in the order written, named after the first glyph using it
+    printf("    \n    // glyph data\n");
+    size_t at = data;
+    while (at < font.size())
+    {
+        size_t end = font.size();
+        uint16_t code = 0;
+        bool packed = false;
+        bool found = false;
+        for (uint16_t g = 0; g < glyphs; g++)
+        {
+            size_t offset = glyphOffsets[g];
+            if (offset == at && !found)
+            {
+                code = source.glyphs[g].code;
+                packed = compressed[g];
+                found = true;
+            }
+            if (offset > at && offset < end)
+                end = offset;
+        }
+        char comment[24];
+        printBytes(font, at, end, glyphComment(comment, sizeof(comment), code, packed));
+        at = end;
+    }
+    printf("};\n\n#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::string name;
+    std::vector<Range> ranges;
+    bool rle = false;
+    bool aligned = true;
+    bool rangeTable = false;
+    int option;
+    while ((option = getopt(argc, argv, "n:r:cot")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'r':
+            if (!parseRanges(optarg, ranges))
+            {
+                fprintf(stderr, "sm16188_fontc: bad range list '%s'\n", optarg);
+                return 2;
+            }
+            break;
+        case 'c':
+            rle = true;
+            break;
+        case 'o':
+            aligned = false;
+            break;
+        case 't':
+            rangeTable = true;
+            break;
+        default:
+            fprintf(stderr, "usage: sm16188_fontc [-n name] [-r ranges] [-c] [-o] [-t] font.bdf > font.h\n");
+            return 2;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        fprintf(stderr, "usage: sm16188_fontc [-n name] [-r ranges] [-c] [-o] [-t] font.bdf > font.h\n");
+        return 2;
+    }
+
+    const char *file = argv[optind];
+    if (name.empty())
+    {
+        const char *base = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+        for (const char *c = base; *c && *c != '.'; c++)
+            name += isalnum((unsigned char)*c) ? *c : '_';
+        if (name.empty() || isdigit((unsigned char)name[0]))
+            name = "Font_" + name;
+    }
+
+    FILE *in = fopen(file, "r");
+    if (!in)
+    {
+        perror(file);
+        return 1;
+    }
+    SM16188FontSource source;
+    source.height = 0;
+    source.aligned = aligned;
+    std::string error;
+    bool read = readBdf(in, ranges, source, error);
+    fclose(in);
+    if (!read)
+    {
+        fprintf(stderr, "sm16188_fontc: %s: %s\n", file, error.c_str());
+        return 1;
+    }
+
+    std::vector<uint8_t> font = sm16188BuildFont(source, rle);
+    std::vector<uint8_t> classic = rangeTable ? std::vector<uint8_t>() : sm16188BuildClassicFont(source);
+    if (!classic.empty() && (font.empty() || classic.size() <= font.size()))
+    {
+        writeClassicHeader(name.c_str(), file, source, classic);
+        return 0;
+    }
+    if (font.empty())
+    {
+        fprintf(stderr, "sm16188_fontc: %s: more than 255 ranges or 64 KB, narrow the ranges with -r\n", file);
+        return 1;
+    }
+    writeHeader(name.c_str(), file, source, font);
+    return 0;
+}
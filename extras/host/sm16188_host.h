@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_host.h - Host (Linux) simulation backend for the sm16188 library.
+
+ Stands in for the pin layer so SM16188<d1, d2> compiles natively. Every pulse clocked
+ out by transfer()/transferBrightness() is counted per pin and, when capture is enabled,
+ recorded in order so benchmarks and protocol checks can inspect the bitstream. Pulses
+ follow each other on a simulated timeline, idle() adds pauses to it.
+
+ Build with -DSM16188_HOST and this directory on the include path (see Makefile).
+--------------------------------------------------------------------------------------*/
+
+#ifndef SM16188_HOST_H_
+#define SM16188_HOST_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#define SM16188_HOST_PINS 64 //number of simulated digital pins
+
+//Send the phases of the AVR bit loop (sendBits()) rather than the nominal ones of the ESP32.
+//Defaults to AVR for the clock rates of AVR boards.
+#ifndef SM16188_HOST_AVR
+#define SM16188_HOST_AVR (F_CPU <= 20000000UL)
+#endif
+
+//One RZ code element on a data line
+struct SM16188HostPulse
+{
+    uint8_t pin;      //data line the pulse was sent on
+    uint8_t level;    //bit value encoded by the pulse width
+    uint16_t highNs;  //HIGH phase width
+    uint16_t lowNs;   //LOW phase width
+    uint64_t startNs; //rising edge on the simulated timeline
+};
+
+class SM16188Host
+{
+public:
+    //Simulated board shared by the Arduino.h stand-in and the sm16188 host backend
+    static SM16188Host &instance()
+    {
+        static SM16188Host host;
+        return host;
+    }
+
+    //Forget all recorded pulses and counters, pin states are kept
+    void clearTrace()
+    {
+        trace.clear();
+        nowNs = 0;
+        pulsesTotal = 0;
+        longestInterruptsOffNs = 0;
+        memset(pinPulses, 0, sizeof(pinPulses));
+    }
+
+    //Called by the sm16188 host backend for every bit clocked out
+    void pulse(uint8_t pin, uint8_t level, uint16_t highNs, uint16_t lowNs)
+    {
+        pulsesTotal++;
+        if (!interruptsEnabled)
+            interruptsOffNs += highNs + lowNs;
+        if (pin < SM16188_HOST_PINS)
+            pinPulses[pin]++;
+        if (capture)
+        {
+            SM16188HostPulse p;
+            p.pin = pin;
+            p.level = level;
+            p.highNs = highNs;
+            p.lowNs = lowNs;
+            p.startNs = nowNs;
+            trace.push_back(p);
+        }
+        nowNs += highNs + lowNs;
+    }
+
+    //Let time pass with every data line LOW, such as the pause between two slices of
+    //updateScreenStep() or the reset after a frame
+    void idle(unsigned long ns)
+    {
+        nowNs += ns;
+    }
+
+    //Run the simulated interrupt handler, if any, as interrupts() enables interrupts. Like a
+    //real handler it is not entered again while it runs.
+    void serviceInterrupt()
+    {
+        if (!interruptHandler || inInterrupt)
+            return;
+        inInterrupt = true;
+        interruptHandler();
+        inInterrupt = false;
+    }
+
+    //Bit values recorded on one pin, in transmit order
+    std::vector<uint8_t> bits(uint8_t pin) const
+    {
+        std::vector<uint8_t> out;
+        for (size_t i = 0; i < trace.size(); i++)
+        {
+            if (trace[i].pin == pin)
+                out.push_back(trace[i].level);
+        }
+        return out;
+    }
+
+    //Recorded pulses (only filled while capture is true)
+    std::vector<SM16188HostPulse> trace;
+    bool capture;
+
+    //Simulated time since clearTrace(), in nanoseconds
+    uint64_t nowNs;
+
+    //Pulse counters, always maintained
+    unsigned long pulsesTotal;
+    unsigned long pinPulses[SM16188_HOST_PINS];
+
+    //Pin state as set through pinMode()/digitalWrite()
+    uint8_t pinModes[SM16188_HOST_PINS];
+    uint8_t pinLevels[SM16188_HOST_PINS];
+
+    //noInterrupts()/interrupts() bookkeeping
+    bool interruptsEnabled;
+    unsigned long interruptBlocks;
+
+    //Simulated timer interrupt, run whenever interrupts are enabled (NULL for none)
+    void (*interruptHandler)();
+    bool inInterrupt;
+
+    //On-wire time of the pulses sent in the current and in the longest interrupts-off window
+    unsigned long interruptsOffNs;
+    unsigned long longestInterruptsOffNs;
+
+private:
+    SM16188Host() : capture(false), nowNs(0), pulsesTotal(0), interruptsEnabled(true), interruptBlocks(0),
+                      interruptHandler(NULL), inInterrupt(false), interruptsOffNs(0), longestInterruptsOffNs(0)
+    {
+        memset(pinPulses, 0, sizeof(pinPulses));
+        memset(pinModes, 0, sizeof(pinModes));
+        memset(pinLevels, 0, sizeof(pinLevels));
+    }
+};
+
+#endif /* SM16188_HOST_H_ */
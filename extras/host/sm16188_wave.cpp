@@ -0,0 +1,387 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_wave.cpp - Waveform decoder and timing checker for the sm16188 library.
+
+ Decodes the d1 and d2 bitstreams of a logic analyser capture, or of refreshes simulated
+ on the host, into frames (chain bytes and 4 bit brightness of each line) and checks every
+ HIGH and LOW phase against the datasheet limits, gaps within frames against
+ SM16188_MAX_GAP_US and frame lengths against the panel layout. See sm16188_wave.h.
+
+ Usage:  sm16188_wave [options] capture.csv   check a capture, - reads stdin
+         sm16188_wave -s [options]            simulate refreshes on the host and check them
+
+   -w wide -h high  panel layout: frames must be that long, and the framebuffer is rebuilt
+   -c layout        CHAIN_* wiring of the panels as a number (default 0, CHAIN_ROWS), looked up
+                    in the panel orders below; CHAIN_ROWS fits any size
+   -l chain         panel order of the chain for any other wiring, see sm16188WaveChain(),
+                    such as "0,0 1,0 1,1r 0,1r"
+   -1 column        CSV column of d1, counted from 0 with the time in column 0 (default 1)
+   -2 column        CSV column of d2 (default 2)
+   -t ns            tolerance of every phase (default SM16188_TIMING_TOLERANCE_NS)
+   -g us            with -s, pause between the slices of updateScreenStep() (default 10)
+   -o file          with -s, also write the simulated capture as CSV
+   -p               print the framebuffer of the last frame
+
+ Exits with 1 when a check fails, so it can guard timing changes in a build.
+--------------------------------------------------------------------------------------*/
+
+#include <sm16188.h>
+#include <sm16188_wave.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#define SIM_D1 1
+#define SIM_D2 2
+
+typedef SM16188<SIM_D1, SIM_D2> Display;
+
+//A frame sent by the simulation, as it should decode
+struct SimFrame
+{
+    int brightness1;
+    int brightness2;
+    std::vector<bool> pixels;
+};
+
+//Panel order of the CHAIN_* layouts, written out by hand rather than worked out as
+//setChainLayout() does, so that a simulation checks the one against the other
+struct LayoutChain
+{
+    int wide;
+    int high;
+    int layout;
+    const char *chain;
+};
+
+static const LayoutChain layoutChains[] = {
+    {2, 1, CHAIN_ROWS, "0,0 1,0"},
+    {3, 2, CHAIN_ROWS, "0,0 1,0 2,0 0,1 1,1 2,1"},
+    {3, 2, CHAIN_SERPENTINE, "0,0 1,0 2,0 2,1 1,1 0,1"},
+    {3, 2, CHAIN_ROTATE_RETURN, "0,0 1,0 2,0 0,1 1,1 2,1"},
+    {3, 2, CHAIN_SERPENTINE | CHAIN_ROTATE_RETURN, "0,0 1,0 2,0 2,1r 1,1r 0,1r"},
+    {3, 2, CHAIN_BOTTOM_UP, "0,1 1,1 2,1 0,0 1,0 2,0"},
+    {3, 2, CHAIN_BOTTOM_UP | CHAIN_SERPENTINE, "0,1 1,1 2,1 2,0 1,0 0,0"},
+    {3, 2, CHAIN_BOTTOM_UP | CHAIN_ROTATE_RETURN, "0,1 1,1 2,1 0,0 1,0 2,0"},
+    {3, 2, CHAIN_BOTTOM_UP | CHAIN_SERPENTINE | CHAIN_ROTATE_RETURN, "0,1 1,1 2,1 2,0r 1,0r 0,0r"},
+    {2, 3, CHAIN_SERPENTINE | CHAIN_ROTATE_RETURN, "0,0 1,0 1,1r 0,1r 0,2 1,2"},
+    {4, 2, CHAIN_SERPENTINE | CHAIN_ROTATE_RETURN, "0,0 1,0 2,0 3,0 3,1r 2,1r 1,1r 0,1r"},
+};
+
+static int pixelsWide;
+static int pixelsHigh;
+
+//Draw pseudo-random pixels, noting them in pixels, and send a frame with updateScreen() or
+//in updateScreenStep() slices gapNs apart
+static void simulateFrame(Display &display, std::vector<bool> &pixels, int brightness1, int brightness2, bool stepped, unsigned long gapNs, std::vector<SimFrame> &frames)
+{
+    SM16188Host &host = SM16188Host::instance();
+    for (int n = 0; n < pixelsWide * pixelsHigh / 3; n++)
+    {
+        int x = rand() % pixelsWide;
+        int y = rand() % pixelsHigh;
+        display.writePixel(x, y, GRAPHICS_TOGGLE, true);
+        pixels[x * pixelsHigh + y] = !pixels[x * pixelsHigh + y];
+    }
+    if (stepped)
+    {
+        while (!display.updateScreenStep(8))
+            host.idle(gapNs);
+    }
+    else
+    {
+        display.updateScreen();
+    }
+    host.idle(SM16188_TRST_US * 1000UL + 10000);
+
+    SimFrame frame;
+    frame.brightness1 = brightness1;
+    frame.brightness2 = brightness2;
+    frame.pixels = pixels;
+    frames.push_back(frame);
+}
+
+static void printLine(const char *name, const SM16188WaveLine &line)
+{
+    printf("%s: %lu frames", name, (unsigned long)line.frames.size());
+    const char *phases[4] = {"T0H", "T0L", "T1H", "T1L"};
+    for (int p = 0; p < 4; p++)
+    {
+        if (line.phases[p].count)
+            printf(", %s %lu-%lu ns", phases[p], (unsigned long)line.phases[p].minNs, (unsigned long)line.phases[p].maxNs);
+    }
+    printf(", %lu gaps", line.gaps);
+    if (line.gaps)
+        printf(" up to %.3f us", line.longestGapNs / 1000.0);
+    printf("\n");
+    for (size_t f = 0; f < line.frames.size(); f++)
+    {
+        const SM16188WaveFrame &frame = line.frames[f];
+        printf("  frame %lu at %.3f ms: %lu bytes, brightness %d%s\n", (unsigned long)f, frame.startNs / 1000000.0,
+               (unsigned long)frame.bytes.size(), frame.brightness, frame.latched ? "" : ", not latched");
+    }
+}
+
+static unsigned long printViolations(const char *name, const SM16188WaveLine &line)
+{
+    for (size_t v = 0; v < line.violations.size() && v < 20; v++)
+    {
+        const SM16188WaveViolation &violation = line.violations[v];
+        printf("%s: frame %lu bit %lu at %.3f us: %s\n", name, (unsigned long)violation.frame, (unsigned long)violation.bit,
+               violation.atNs / 1000.0, violation.what.c_str());
+    }
+    if (line.violations.size() > 20)
+        printf("%s: %lu more violations\n", name, (unsigned long)line.violations.size() - 20);
+    return line.violations.size();
+}
+
+static void printFramebuffer(const std::vector<uint8_t> &framebuffer, int wide, int high)
+{
+    int columnBytes = 2 * high;
+    for (int y = 0; y < SM16188_PIXELS_DOWN * high; y++)
+    {
+        for (int x = 0; x < SM16188_PIXELS_ACROSS * wide; x++)
+            putchar((framebuffer[x * columnBytes + y / 8] >> (y & 7)) & 1 ? '#' : '.');
+        putchar('\n');
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: sm16188_wave [-w wide -h high] [-c layout | -l chain] [-1 column] [-2 column] [-t ns] [-p] capture.csv\n"
+                    "       sm16188_wave -s [-w wide -h high] [-c layout | -l chain] [-t ns] [-g us] [-o file] [-p]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int wide = 0;
+    int high = 0;
+    int layout = CHAIN_ROWS;
+    const char *chainText = NULL;
+    int d1Column = 1;
+    int d2Column = 2;
+    bool simulate = false;
+    unsigned long gapNs = 10000;
+    const char *csv = NULL;
+    bool print = false;
+    SM16188WaveLimits limits = sm16188WaveDatasheet();
+    int option;
+    while ((option = getopt(argc, argv, "w:h:c:l:1:2:t:sg:o:p")) != -1)
+    {
+        switch (option)
+        {
+        case 'w':
+            wide = atoi(optarg);
+            break;
+        case 'h':
+            high = atoi(optarg);
+            break;
+        case 'c':
+            layout = atoi(optarg);
+            break;
+        case 'l':
+            chainText = optarg;
+            break;
+        case '1':
+            d1Column = atoi(optarg);
+            break;
+        case '2':
+            d2Column = atoi(optarg);
+            break;
+        case 't':
+            limits.toleranceNs = atoi(optarg);
+            break;
+        case 's':
+            simulate = true;
+            break;
+        case 'g':
+            gapNs = strtoul(optarg, NULL, 10) * 1000UL;
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        case 'p':
+            print = true;
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if ((wide > 0) != (high > 0) || wide < 0 || high < 0 || wide * high > 255 || d1Column < 1 || d2Column < 1 ||
+        (simulate ? optind != argc : optind + 1 != argc))
+    {
+        usage();
+        return 2;
+    }
+    if (simulate && !wide)
+    {
+        wide = 2;
+        high = 1;
+    }
+    limits.panels = wide * high;
+
+    // the panel order the frames are rebuilt with: given, from the table of layouts, or for
+    // CHAIN_ROWS of any size every row left to right
+    std::vector<SM16188WavePanel> chain;
+    bool chainGiven = chainText != NULL;
+    std::string rows;
+    if (wide)
+    {
+        for (size_t l = 0; !chainText && l < sizeof(layoutChains) / sizeof(layoutChains[0]); l++)
+        {
+            if (layoutChains[l].wide == wide && layoutChains[l].high == high && layoutChains[l].layout == layout)
+                chainText = layoutChains[l].chain;
+        }
+        for (int n = 0; !chainText && layout == CHAIN_ROWS && n < wide * high; n++)
+            rows += std::to_string(n % wide) + "," + std::to_string(n / wide) + " ";
+        if (!rows.empty())
+            chainText = rows.c_str();
+        std::string error;
+        if (!chainText)
+        {
+            fprintf(stderr, "sm16188_wave: no panel order for layout %d of %dx%d panels, give it with -l\n", layout, wide, high);
+            return 2;
+        }
+        if (!sm16188WaveChain(chainText, wide, high, chain, error))
+        {
+            fprintf(stderr, "sm16188_wave: panel order: %s\n", error.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<SM16188WavePulse> d1;
+    std::vector<SM16188WavePulse> d2;
+    std::vector<SimFrame> frames;
+    if (simulate)
+    {
+        // a frame from updateScreen(), then one sent in slices
+        static Display display;
+        SM16188Host &host = SM16188Host::instance();
+        pixelsWide = SM16188_PIXELS_ACROSS * wide;
+        pixelsHigh = SM16188_PIXELS_DOWN * high;
+        std::vector<bool> pixels(pixelsWide * pixelsHigh, false);
+        if (!display.begin(wide, high))
+        {
+            fprintf(stderr, "sm16188_wave: out of memory\n");
+            return 1;
+        }
+        // routed by setChainLayout(), or panel by panel as the chain given says
+        if (chainGiven)
+        {
+            for (size_t position = 0; position < chain.size(); position++)
+                display.setPanelRoute(position, chain[position].x, chain[position].y, chain[position].rotated);
+        }
+        else
+        {
+            display.setChainLayout(layout);
+        }
+        display.setKeepAlive(0);
+        host.clearTrace();
+        host.capture = true;
+        display.setBrightness(9, HALF_UPPER);
+        display.setBrightness(5, HALF_LOWER);
+        simulateFrame(display, pixels, 9, 5, false, gapNs, frames);
+        display.setBrightness(15);
+        simulateFrame(display, pixels, 15, 15, true, gapNs, frames);
+        host.capture = false;
+
+        d1 = sm16188HostPulses(host.trace, SIM_D1, host.nowNs);
+        d2 = sm16188HostPulses(host.trace, SIM_D2, host.nowNs);
+        if (csv)
+        {
+            FILE *out = fopen(csv, "w");
+            if (!out)
+            {
+                perror(csv);
+                return 1;
+            }
+            sm16188WriteCsv(out, host.trace, SIM_D1, SIM_D2, host.nowNs);
+            fclose(out);
+        }
+    }
+    else
+    {
+        const char *file = argv[optind];
+        FILE *in = strcmp(file, "-") ? fopen(file, "r") : stdin;
+        if (!in)
+        {
+            perror(file);
+            return 1;
+        }
+        std::string error;
+        bool read = sm16188ReadCsv(in, d1Column, d2Column, d1, d2, error);
+        if (in != stdin)
+            fclose(in);
+        if (!read)
+        {
+            fprintf(stderr, "sm16188_wave: %s: %s\n", file, error.c_str());
+            return 1;
+        }
+    }
+
+    SM16188WaveLine lines[2] = {sm16188DecodeLine(d1, limits), sm16188DecodeLine(d2, limits)};
+    printLine("d1", lines[0]);
+    printLine("d2", lines[1]);
+    unsigned long failures = printViolations("d1", lines[0]) + printViolations("d2", lines[1]);
+    if (lines[0].frames.size() != lines[1].frames.size())
+    {
+        printf("d1 and d2 carry %lu and %lu frames\n", (unsigned long)lines[0].frames.size(), (unsigned long)lines[1].frames.size());
+        failures++;
+    }
+
+    // each frame of the two lines together, against what the simulation sent
+    size_t count = lines[0].frames.size() < lines[1].frames.size() ? lines[0].frames.size() : lines[1].frames.size();
+    std::vector<uint8_t> framebuffer;
+    for (size_t f = 0; f < count; f++)
+    {
+        const SM16188WaveFrame &frame1 = lines[0].frames[f];
+        const SM16188WaveFrame &frame2 = lines[1].frames[f];
+        bool rebuilt = wide && sm16188WaveFramebuffer(frame1, frame2, wide, high, chain, framebuffer);
+        if (!simulate)
+            continue;
+        if (f >= frames.size())
+        {
+            printf("frame %lu: not sent by the simulation\n", (unsigned long)f);
+            failures++;
+            continue;
+        }
+        if (frame1.brightness != frames[f].brightness1 || frame2.brightness != frames[f].brightness2)
+        {
+            printf("frame %lu: brightness %d and %d decoded, %d and %d set\n", (unsigned long)f, frame1.brightness,
+                   frame2.brightness, frames[f].brightness1, frames[f].brightness2);
+            failures++;
+        }
+        bool same = rebuilt;
+        for (int x = 0; same && x < pixelsWide; x++)
+        {
+            for (int y = 0; y < pixelsHigh; y++)
+            {
+                if (((framebuffer[x * 2 * high + y / 8] >> (y & 7)) & 1) != frames[f].pixels[x * pixelsHigh + y])
+                    same = false;
+            }
+        }
+        if (!same)
+        {
+            printf("frame %lu: rebuilt framebuffer differs from the pixels drawn\n", (unsigned long)f);
+            failures++;
+        }
+    }
+    if (simulate && count != frames.size())
+    {
+        printf("%lu frames sent, %lu decoded\n", (unsigned long)frames.size(), (unsigned long)count);
+        failures++;
+    }
+    if (print && !framebuffer.empty())
+        printFramebuffer(framebuffer, wide, high);
+
+    if (failures)
+    {
+        printf("FAIL: %lu problems\n", failures);
+        return 1;
+    }
+    printf("OK%s\n", simulate ? ": decoded frames match what was sent" : "");
+    return 0;
+}
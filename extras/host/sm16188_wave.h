@@ -0,0 +1,452 @@
+/*--------------------------------------------------------------------------------------
+ sm16188_wave.h - Host side waveform decoding and timing checks for the sm16188 library.
+
+ Turns the pulses on the d1 and d2 lines, recorded by SM16188Host or captured with a
+ logic analyser, back into frames: the chain bytes and 4 bit brightness of each line and
+ the framebuffer they show. Every phase is checked against the datasheet timing in
+ sm16188.h and docs/timing.md. Used by the sm16188_wave tool.
+--------------------------------------------------------------------------------------*/
+
+#ifndef SM16188_WAVE_H_
+#define SM16188_WAVE_H_
+
+#include <sm16188.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+//One RZ pulse on a data line
+struct SM16188WavePulse
+{
+    uint64_t startNs; //rising edge
+    uint32_t highNs;  //HIGH phase
+    uint32_t lowNs;   //LOW phase up to the next rising edge, or to the end of the capture
+    bool last;        //the capture ends during the LOW phase
+};
+
+//A frame rebuilt from one data line
+struct SM16188WaveFrame
+{
+    uint64_t startNs;
+    size_t bits;
+    std::vector<uint8_t> bytes; //chain data, as in txBuffer()
+    uint8_t brightness;         //4 bit current gain sent after the data
+    bool latched;               //followed by a reset, not cut off by the end of the capture
+};
+
+//A phase outside the datasheet limits
+struct SM16188WaveViolation
+{
+    uint64_t atNs;
+    size_t frame;
+    size_t bit;
+    std::string what;
+};
+
+//Shortest and longest width seen of one phase
+struct SM16188WaveRange
+{
+    uint32_t minNs;
+    uint32_t maxNs;
+    unsigned long count;
+};
+
+//Everything found on one data line
+struct SM16188WaveLine
+{
+    std::vector<SM16188WaveFrame> frames;
+    std::vector<SM16188WaveViolation> violations;
+    SM16188WaveRange phases[4]; //T0H, T0L, T1H, T1L, the LOW phases without gaps and resets
+    unsigned long gaps;         //LOW phases between two bytes beyond the tolerance but below SM16188_MAX_GAP_US
+    uint32_t longestGapNs;
+};
+
+//Timing limits a line is checked against, from the datasheet unless changed
+struct SM16188WaveLimits
+{
+    uint32_t phaseNs[4]; //nominal T0H, T0L, T1H, T1L
+    uint32_t toleranceNs;
+    uint32_t maxGapNs;
+    uint32_t resetNs;
+    unsigned int panels; //expected chain length, 0 to accept any whole number of bytes
+};
+
+inline SM16188WaveLimits sm16188WaveDatasheet()
+{
+    SM16188WaveLimits limits;
+    limits.phaseNs[0] = SM16188_T0H_NS;
+    limits.phaseNs[1] = SM16188_T0L_NS;
+    limits.phaseNs[2] = SM16188_T1H_NS;
+    limits.phaseNs[3] = SM16188_T1L_NS;
+    limits.toleranceNs = SM16188_TIMING_TOLERANCE_NS;
+    limits.maxGapNs = SM16188_MAX_GAP_US * 1000UL;
+    limits.resetNs = SM16188_TRST_US * 1000UL;
+    limits.panels = 0;
+    return limits;
+}
+
+inline void sm16188WaveMeasure(SM16188WaveRange &range, uint32_t ns)
+{
+    if (!range.count || ns < range.minNs)
+        range.minNs = ns;
+    if (!range.count || ns > range.maxNs)
+        range.maxNs = ns;
+    range.count++;
+}
+
+//Pulses of one pin recorded by SM16188Host (capture on), up to endNs on its timeline
+inline std::vector<SM16188WavePulse> sm16188HostPulses(const std::vector<SM16188HostPulse> &trace, uint8_t pin, uint64_t endNs)
+{
+    std::vector<SM16188WavePulse> pulses;
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        if (trace[i].pin != pin)
+            continue;
+        if (!pulses.empty())
+            pulses.back().lowNs = trace[i].startNs - pulses.back().startNs - pulses.back().highNs;
+        SM16188WavePulse pulse;
+        pulse.startNs = trace[i].startNs;
+        pulse.highNs = trace[i].highNs;
+        pulse.lowNs = 0;
+        pulse.last = false;
+        pulses.push_back(pulse);
+    }
+    if (!pulses.empty())
+    {
+        pulses.back().lowNs = endNs - pulses.back().startNs - pulses.back().highNs;
+        pulses.back().last = true;
+    }
+    return pulses;
+}
+
+//Write an SM16188Host trace as a logic analyser CSV: a header, then the time in seconds and the
+//levels of d1 and d2 at every edge, and a last row at endNs
+inline void sm16188WriteCsv(FILE *out, const std::vector<SM16188HostPulse> &trace, uint8_t d1, uint8_t d2, uint64_t endNs)
+{
+    fprintf(out, "Time [s],d1,d2\n");
+    fprintf(out, "0.000000000,0,0\n");
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        if (trace[i].pin != d1 && trace[i].pin != d2)
+            continue;
+        uint64_t rise = trace[i].startNs;
+        uint64_t fall = rise + trace[i].highNs;
+        fprintf(out, "%llu.%09llu,%d,%d\n", (unsigned long long)(rise / 1000000000), (unsigned long long)(rise % 1000000000),
+                trace[i].pin == d1, trace[i].pin == d2);
+        fprintf(out, "%llu.%09llu,0,0\n", (unsigned long long)(fall / 1000000000), (unsigned long long)(fall % 1000000000));
+    }
+    fprintf(out, "%llu.%09llu,0,0\n", (unsigned long long)(endNs / 1000000000), (unsigned long long)(endNs % 1000000000));
+}
+
+//Time in seconds of a CSV field as nanoseconds, exact for up to 9 decimals. Captures with a
+//trigger start at negative times.
+inline bool sm16188ParseSeconds(const char *text, int64_t &ns)
+{
+    bool negative = *text == '-';
+    const char *digits = negative ? text + 1 : text;
+    if (!(*digits >= '0' && *digits <= '9') && !(*digits == '.' && digits[1] >= '0' && digits[1] <= '9'))
+        return false;
+    char *end;
+    int64_t value = strtoull(digits, &end, 10) * 1000000000LL;
+    if (*end == '.')
+    {
+        int64_t scale = 100000000;
+        for (end++; *end >= '0' && *end <= '9'; end++, scale /= 10)
+            value += (*end - '0') * scale;
+    }
+    ns = negative ? -value : value;
+    return *end == '\0' || *end == '\r' || *end == '\n' || *end == ' ';
+}
+
+//Pulses of the d1 and d2 columns (counted from 0, the time is column 0) of a logic analyser
+//CSV with a row per change, such as a Saleae or sigrok export. Rows that do not start with a
+//time, such as headers, are skipped. A line that is HIGH when the capture starts is taken
+//up from its first rising edge.
+inline bool sm16188ReadCsv(FILE *in, int d1Column, int d2Column, std::vector<SM16188WavePulse> &d1, std::vector<SM16188WavePulse> &d2, std::string &error)
+{
+    std::vector<SM16188WavePulse> *lines[2] = {&d1, &d2};
+    int columns[2] = {d1Column, d2Column};
+    int levels[2] = {-1, -1};
+    uint64_t falls[2] = {0, 0};
+    int64_t first = 0;
+    int64_t time = 0;
+    uint64_t now = 0;
+    bool any = false;
+    char row[512];
+    unsigned long number = 0;
+    while (fgets(row, sizeof(row), in))
+    {
+        number++;
+        std::vector<const char *> fields;
+        for (char *field = row;; field++)
+        {
+            fields.push_back(field);
+            field = strpbrk(field, ",;\t");
+            if (!field)
+                break;
+            *field = '\0';
+        }
+        if (!sm16188ParseSeconds(fields[0], time))
+            continue;
+        if (!any)
+            first = time;
+        if (time < first + (int64_t)now)
+        {
+            error = "time goes backwards in row " + std::to_string(number);
+            return false;
+        }
+        // from the first row on
+        now = time - first;
+        any = true;
+        for (int l = 0; l < 2; l++)
+        {
+            if (columns[l] >= (int)fields.size())
+            {
+                error = "row " + std::to_string(number) + " has no column " + std::to_string(columns[l]);
+                return false;
+            }
+            int level = atoi(fields[columns[l]]) ? 1 : 0;
+            std::vector<SM16188WavePulse> &pulses = *lines[l];
+            if (levels[l] == 0 && level == 1)
+            {
+                if (!pulses.empty())
+                    pulses.back().lowNs = now - falls[l];
+                SM16188WavePulse pulse;
+                pulse.startNs = now;
+                pulse.highNs = 0;
+                pulse.lowNs = 0;
+                pulse.last = false;
+                pulses.push_back(pulse);
+            }
+            else if (levels[l] == 1 && level == 0 && !pulses.empty())
+            {
+                pulses.back().highNs = now - pulses.back().startNs;
+                falls[l] = now;
+            }
+            levels[l] = level;
+        }
+    }
+    if (!any)
+    {
+        error = "no rows with a time";
+        return false;
+    }
+    for (int l = 0; l < 2; l++)
+    {
+        std::vector<SM16188WavePulse> &pulses = *lines[l];
+        if (pulses.empty())
+            continue;
+        // a pulse still HIGH at the end is dropped, the LOW of the one before it is complete
+        if (levels[l] == 1)
+        {
+            pulses.pop_back();
+            continue;
+        }
+        pulses.back().lowNs = now - falls[l];
+        pulses.back().last = true;
+    }
+    return true;
+}
+
+//Decode the frames of one line and check every phase against limits. A LOW of at least
+//resetNs ends a frame; a longer LOW within a frame is a gap, allowed between two bytes up to
+//maxGapNs. Within a byte every LOW has to be a bit code.
+inline SM16188WaveLine sm16188DecodeLine(const std::vector<SM16188WavePulse> &pulses, const SM16188WaveLimits &limits)
+{
+    SM16188WaveLine line;
+    memset(line.phases, 0, sizeof(line.phases));
+    line.gaps = 0;
+    line.longestGapNs = 0;
+    std::vector<uint8_t> bits;
+    uint64_t frameStart = 0;
+    char text[128];
+
+    for (size_t i = 0; i < pulses.size(); i++)
+    {
+        const SM16188WavePulse &pulse = pulses[i];
+        if (bits.empty())
+            frameStart = pulse.startNs;
+
+        // the bit is the nearer of the two HIGH widths
+        uint8_t bit = pulse.highNs * 2 >= limits.phaseNs[0] + limits.phaseNs[2];
+        const char *names[4] = {"T0H", "T0L", "T1H", "T1L"};
+        byte high = bit ? 2 : 0;
+        byte low = high + 1;
+        sm16188WaveMeasure(line.phases[high], pulse.highNs);
+        if (pulse.highNs + limits.toleranceNs < limits.phaseNs[high] || pulse.highNs > limits.phaseNs[high] + limits.toleranceNs)
+        {
+            snprintf(text, sizeof(text), "%s %lu ns, limits %lu to %lu ns", names[high], (unsigned long)pulse.highNs,
+                     (unsigned long)(limits.phaseNs[high] - limits.toleranceNs), (unsigned long)(limits.phaseNs[high] + limits.toleranceNs));
+            SM16188WaveViolation violation = {pulse.startNs, line.frames.size(), bits.size(), text};
+            line.violations.push_back(violation);
+        }
+        bits.push_back(bit);
+
+        bool reset = pulse.lowNs >= limits.resetNs;
+        if (!reset && !pulse.last)
+        {
+            if (pulse.lowNs + limits.toleranceNs < limits.phaseNs[low] ||
+                (pulse.lowNs > limits.phaseNs[low] + limits.toleranceNs && bits.size() % 8))
+            {
+                snprintf(text, sizeof(text), "%s %lu ns, limits %lu to %lu ns", names[low], (unsigned long)pulse.lowNs,
+                         (unsigned long)(limits.phaseNs[low] - limits.toleranceNs), (unsigned long)(limits.phaseNs[low] + limits.toleranceNs));
+                SM16188WaveViolation violation = {pulse.startNs + pulse.highNs, line.frames.size(), bits.size() - 1, text};
+                line.violations.push_back(violation);
+            }
+            else if (pulse.lowNs > limits.phaseNs[low] + limits.toleranceNs)
+            {
+                line.gaps++;
+                if (pulse.lowNs > line.longestGapNs)
+                    line.longestGapNs = pulse.lowNs;
+                if (pulse.lowNs > limits.maxGapNs)
+                {
+                    snprintf(text, sizeof(text), "gap of %lu ns in a frame, may latch it (limit %lu ns)", (unsigned long)pulse.lowNs,
+                             (unsigned long)limits.maxGapNs);
+                    SM16188WaveViolation violation = {pulse.startNs + pulse.highNs, line.frames.size(), bits.size() - 1, text};
+                    line.violations.push_back(violation);
+                }
+            }
+            else
+            {
+                sm16188WaveMeasure(line.phases[low], pulse.lowNs);
+            }
+            continue;
+        }
+
+        // end of the frame: whole bytes of chain data, then the 4 bit brightness
+        SM16188WaveFrame frame;
+        frame.startNs = frameStart;
+        frame.bits = bits.size();
+        frame.latched = reset;
+        frame.brightness = 0;
+        for (size_t b = 0; b + 4 < bits.size(); b += 8)
+        {
+            uint8_t value = 0;
+            for (size_t k = b; k < b + 8 && k + 4 < bits.size(); k++)
+                value |= bits[k] << (7 - (k - b));
+            frame.bytes.push_back(value);
+        }
+        for (size_t k = bits.size() >= 4 ? bits.size() - 4 : 0; k < bits.size(); k++)
+            frame.brightness = (frame.brightness << 1) | bits[k];
+
+        size_t expected = 8 * (size_t)SM16188_PIXELS_ACROSS * limits.panels + 4;
+        if (bits.size() < 4 || (bits.size() - 4) % 8 || (limits.panels && bits.size() != expected))
+        {
+            if (limits.panels)
+                snprintf(text, sizeof(text), "frame of %lu bits, %lu expected for %u panels", (unsigned long)bits.size(),
+                         (unsigned long)expected, limits.panels);
+            else
+                snprintf(text, sizeof(text), "frame of %lu bits is not whole bytes and 4 brightness bits", (unsigned long)bits.size());
+            SM16188WaveViolation violation = {frameStart, line.frames.size(), 0, text};
+            line.violations.push_back(violation);
+        }
+        if (!reset)
+        {
+            snprintf(text, sizeof(text), "capture ends %lu ns into the reset, before it latches", (unsigned long)pulse.lowNs);
+            SM16188WaveViolation violation = {pulse.startNs + pulse.highNs, line.frames.size(), bits.size() - 1, text};
+            line.violations.push_back(violation);
+        }
+        line.frames.push_back(frame);
+        bits.clear();
+    }
+    return line;
+}
+
+//A panel of the chain: its column and row on the display, in panels, and whether it is
+//mounted upside down
+struct SM16188WavePanel
+{
+    uint8_t x;
+    uint8_t y;
+    bool rotated;
+};
+
+//Read the panels of a chain, the one nearest the controller first, written as x,y with an r
+//after the panels mounted upside down, such as "0,0 1,0 1,1r 0,1r". Every panel of a display
+//of wide by high panels must be there once.
+inline bool sm16188WaveChain(const char *text, uint8_t wide, uint8_t high, std::vector<SM16188WavePanel> &chain, std::string &error)
+{
+    chain.clear();
+    std::vector<bool> seen(wide * high, false);
+    while (*text)
+    {
+        if (*text == ' ')
+        {
+            text++;
+            continue;
+        }
+        char *end;
+        long x = strtol(text, &end, 10);
+        long y = -1;
+        if (end != text && *end == ',')
+        {
+            text = end + 1;
+            y = strtol(text, &end, 10);
+        }
+        if (end == text || x < 0 || x >= wide || y < 0 || y >= high || seen[y * wide + x])
+        {
+            error = std::string("bad or repeated panel at \"") + text + "\"";
+            return false;
+        }
+        seen[y * wide + x] = true;
+        SM16188WavePanel panel = {(uint8_t)x, (uint8_t)y, *end == 'r'};
+        chain.push_back(panel);
+        text = end + (*end == 'r' ? 1 : 0);
+        if (*text && *text != ' ')
+        {
+            error = std::string("bad panel at \"") + text + "\"";
+            return false;
+        }
+    }
+    if (chain.size() != seen.size())
+    {
+        error = "not every panel is in the chain";
+        return false;
+    }
+    return true;
+}
+
+//Rebuild the framebuffer of a display of wide by high panels, wired as chain says (see
+//sm16188WaveChain()), from a frame of each line; false if they are not the right length.
+//The result is laid out like the library's framebuffer: columns of 2 * high bytes.
+inline bool sm16188WaveFramebuffer(const SM16188WaveFrame &d1, const SM16188WaveFrame &d2, uint8_t wide, uint8_t high, const std::vector<SM16188WavePanel> &chain, std::vector<uint8_t> &framebuffer)
+{
+    unsigned int panels = wide * high;
+    if (chain.size() != panels || d1.bytes.size() != panels * SM16188_PIXELS_ACROSS || d2.bytes.size() != panels * SM16188_PIXELS_ACROSS)
+        return false;
+    framebuffer.assign(panels * SM16188_RAM_SIZE_BYTES, 0);
+
+    // each line carries the furthest panel first, a byte per column of the panel from its own
+    // right edge leftwards; bit b is row b of the panel's upper half on d1, of its lower half
+    // on d2, counted from its own top edge. An upside down panel is turned around on the display.
+    for (uint8_t line = 0; line < 2; line++)
+    {
+        const std::vector<uint8_t> &bytes = line == 0 ? d1.bytes : d2.bytes;
+        for (unsigned int n = 0; n < bytes.size(); n++)
+        {
+            const SM16188WavePanel &panel = chain[panels - 1 - n / SM16188_PIXELS_ACROSS];
+            for (uint8_t b = 0; b < 8; b++)
+            {
+                if (!((bytes[n] >> b) & 1))
+                    continue;
+                int u = SM16188_PIXELS_ACROSS - 1 - n % SM16188_PIXELS_ACROSS;
+                int v = line * SM16188_HALF_PIXELS_DOWN + b;
+                if (panel.rotated)
+                {
+                    u = SM16188_PIXELS_ACROSS - 1 - u;
+                    v = SM16188_PIXELS_DOWN - 1 - v;
+                }
+                int x = panel.x * SM16188_PIXELS_ACROSS + u;
+                int y = panel.y * SM16188_PIXELS_DOWN + v;
+                framebuffer[x * 2 * high + y / 8] |= 1 << (y & 7);
+            }
+        }
+    }
+    return true;
+}
+
+#endif /* SM16188_WAVE_H_ */
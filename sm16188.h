@@ -28,6 +28,9 @@ Modified by: Andrey Syutkin  // syutkin@gmail.com
 
 #elif defined(ESP32)
 #include "driver/gpio.h"
+
+#elif defined(SM16188_HOST)
+#include "sm16188_host.h"
 #endif
 
 //display screen (and subscreen) sizing
@@ -52,40 +55,460 @@ Modified by: Andrey Syutkin  // syutkin@gmail.com
 #define FONT_CHAR_COUNT 5
 #define FONT_WIDTH_TABLE 6
 
+//Fonts with sparse Unicode ranges have FONT_FIRST_CHAR and FONT_CHAR_COUNT 0 and continue with
+#define FONT_FLAGS 6        //FONT_FLAG_* bits
+#define FONT_RANGE_COUNT 7  //number of code point ranges
+#define FONT_GLYPH_COUNT 8  //uint16 number of glyphs
+#define FONT_RANGE_TABLE 10 //ranges sorted by code point, FONT_RANGE_SIZE bytes each
+#define FONT_RANGE_SIZE 6   //uint16 first code point, uint16 code point count, uint16 first glyph
+//then a width byte per glyph, a uint16 data offset from the start of the font per glyph (see
+//FONT_RLE_BLOCK for RLE fonts) and the glyph data, laid out as in other fonts. uint16 values
+//are little-endian. Text in these fonts is UTF-8.
+
+//Font flags
+#define FONT_FLAG_RLE 1     //glyph data compressed, see SM16188RleReader
+#define FONT_FLAG_ALIGNED 2 //every band of 8 rows starts at a multiple of 8, the last one does not overlap the one above
+
+//FONT_FLAG_RLE fonts replace the data offsets by a uint16 offset for every FONT_RLE_BLOCK glyphs,
+//to the data of the first glyph of the block, then a size byte per glyph: the length of its
+//compressed data, or 0 for a glyph stored uncompressed in width * bytes. The glyph data follow
+//in glyph order, each compressed only where that makes it shorter.
+#define FONT_RLE_BLOCK 8
+
+//Glyph offset index built by selectFont() for variable width fonts: one entry every
+//SM16188_GLYPH_INDEX_STEP glyphs, so a lookup sums at most STEP - 1 widths from flash
+#ifndef SM16188_GLYPH_INDEX_STEP
+#ifdef __AVR__
+#define SM16188_GLYPH_INDEX_STEP 4
+#else
+#define SM16188_GLYPH_INDEX_STEP 1
+#endif
+#endif
+#ifndef SM16188_GLYPH_INDEX_SIZE
+#define SM16188_GLYPH_INDEX_SIZE ((255 + SM16188_GLYPH_INDEX_STEP) / SM16188_GLYPH_INDEX_STEP)
+#endif
+
+//Panel chain wiring for setChainLayout(), combine with |. The chain starts at the controller with the top
+//left panel and runs left to right along each row of panels, then on to the next row down.
+#define CHAIN_ROWS 0          //every row left to right
+#define CHAIN_SERPENTINE 1    //every other row right to left, continuing from the end of the row before
+#define CHAIN_ROTATE_RETURN 2 //with CHAIN_SERPENTINE, panels on the right to left rows are upside down
+#define CHAIN_BOTTOM_UP 4     //the chain starts at the bottom row and runs upwards
+
+//Panel halves for setBrightness() and fadeBrightness(), by data line: the upper half of an
+//upright panel is on d1 and the lower half on d2
+#define HALF_UPPER 1
+#define HALF_LOWER 2
+#define HALF_BOTH 3
+
+//Glyph widths cached by selectFont(), for charWidth() and measureString()
+#ifndef SM16188_WIDTH_CACHE_SIZE
+#ifdef __AVR__
+#define SM16188_WIDTH_CACHE_SIZE 96
+#else
+#define SM16188_WIDTH_CACHE_SIZE 256
+#endif
+#endif
+
+//Text alignment for drawStringAligned() and drawTextBox()
+#define ALIGN_LEFT 0
+#define ALIGN_CENTER 1
+#define ALIGN_RIGHT 2
+
 //drawTestPattern Patterns
 #define PATTERN_ALT_0 0
 #define PATTERN_ALT_1 1
 #define PATTERN_STRIPE_0 2
 #define PATTERN_STRIPE_1 3
 
+//Default number of skipped updateScreen() calls before an unchanged frame is resent anyway
+#ifndef SM16188_KEEPALIVE_CALLS
+#define SM16188_KEEPALIVE_CALLS 100
+#endif
+
+//Bytes sent per interrupts-off window by updateScreenStep(), about 8us each at the datasheet timing
+#ifndef SM16188_STEP_LOCK_BYTES
+#define SM16188_STEP_LOCK_BYTES 1
+#endif
+
+//Keep the encoded frame in a transmit buffer of 2 * (32 * panels + 1) bytes, see txBuffer().
+//With 0 the refresh reads each byte from the framebuffer through the routing table as it
+//sends it, which saves that RAM but lets drawing between updateScreenStep() slices show up
+//in the frame being sent.
+#ifndef SM16188_TX_BUFFER
+#define SM16188_TX_BUFFER 1
+#endif
+
+//RZ code timing from the datasheet (docs/sm16188b datasheet.pdf), in nanoseconds
+#define SM16188_T0H_NS 240              //0 code, HIGH level
+#define SM16188_T0L_NS 720              //0 code, LOW level
+#define SM16188_T1H_NS 720              //1 code, HIGH level
+#define SM16188_T1L_NS 240              //1 code, LOW level
+#define SM16188_TIMING_TOLERANCE_NS 50  //allowable deviation of every phase
+#define SM16188_TRST_US 150             //reset (latch), minimum LOW level in microseconds
+#define SM16188_MAX_GAP_US 50           //longest LOW between bits we rely on not to latch (docs/timing.md)
+
+//Conversions between nanoseconds and CPU cycles at F_CPU, rounded to nearest
+#define SM16188_NS_TO_CYCLES(ns) (((unsigned long)(ns) * (F_CPU / 1000000UL) + 500) / 1000)
+#define SM16188_CYCLES_TO_NS(cycles) (((unsigned long)(cycles) * 1000UL + (F_CPU / 2000000UL)) / (F_CPU / 1000000UL))
+
+//Bit timing in CPU cycles, computed at compile time (at least one cycle per phase)
+#define SM16188_PHASE_CYCLES(ns) (SM16188_NS_TO_CYCLES(ns) > 0 ? SM16188_NS_TO_CYCLES(ns) : 1)
+#define SM16188_T0H_CYCLES SM16188_PHASE_CYCLES(SM16188_T0H_NS)
+#define SM16188_T0L_CYCLES SM16188_PHASE_CYCLES(SM16188_T0L_NS)
+#define SM16188_T1H_CYCLES SM16188_PHASE_CYCLES(SM16188_T1H_NS)
+#define SM16188_T1L_CYCLES SM16188_PHASE_CYCLES(SM16188_T1L_NS)
+
+//Phases in CPU cycles as the bit loop sends them. The AVR loop (sendBits()) is cycle counted
+//assembly whose instructions set a floor on each phase: 3 cycles from the rising edge to the
+//falling edge of a 0, 6 more to that of a 1 and 4 from there to the next rising edge. Nops pad
+//the phases up to the datasheet, and a 0 takes as long as a 1. The ESP32 loop times each edge
+//from the rising one with the cycle counter.
+#if defined(__AVR__) || (defined(SM16188_HOST) && SM16188_HOST_AVR)
+#define SM16188_AVR_CYCLES(cycles, floor) ((cycles) > (floor) ? (cycles) : (floor))
+#define SM16188_BIT_T0H_CYCLES SM16188_AVR_CYCLES(SM16188_T0H_CYCLES, 3)
+#define SM16188_BIT_T1H_CYCLES SM16188_AVR_CYCLES(SM16188_T1H_CYCLES, SM16188_BIT_T0H_CYCLES + 6)
+#define SM16188_BIT_T1L_CYCLES SM16188_AVR_CYCLES(SM16188_T1L_CYCLES, 4)
+#define SM16188_BIT_T0L_CYCLES (SM16188_BIT_T1H_CYCLES + SM16188_BIT_T1L_CYCLES - SM16188_BIT_T0H_CYCLES)
+#else
+#define SM16188_BIT_T0H_CYCLES SM16188_T0H_CYCLES
+#define SM16188_BIT_T0L_CYCLES SM16188_T0L_CYCLES
+#define SM16188_BIT_T1H_CYCLES SM16188_T1H_CYCLES
+#define SM16188_BIT_T1L_CYCLES SM16188_T1L_CYCLES
+#endif
+
 typedef uint8_t (*FontCallback)(const uint8_t *);
 
-//The main class of SM16188 library functions
-#ifdef __AVR__
-template <uint8_t d1, uint8_t d2>
-#elif defined(ESP32)
-template <gpio_num_t d1, gpio_num_t d2>
+//Data line pin type of the target platform
+#ifdef ESP32
+typedef gpio_num_t sm16188_pin_t;
+#else
+typedef uint8_t sm16188_pin_t;
+#endif
+
+//Transmit stream built by encodeFrame(): per data line, one byte per chip column plus the brightness trailer
+#define SM16188_TX_LINE_BYTES(panels) (SM16188_PIXELS_ACROSS * (panels) + 1)
+#define SM16188_TX_BYTES(panels) (2 * SM16188_TX_LINE_BYTES(panels))
+
+//One panel of the chain, as built by begin() and setPanelRoute()
+struct SM16188Route
+{
+    uint16_t start; //framebuffer index of the first byte this panel is sent on d1
+    uint16_t panel; //y * panelsWide() + x, index of the panel's brightness level
+    bool rotated;   //mounted upside down: columns, halves and rows are reversed
+};
+
+//A brightness level from 0 to 15, moved along sm16188FadeCurve by one step per refresh
+struct SM16188Fade
+{
+    byte level;        //current level
+    byte from;         //level at the start of the fade
+    byte to;           //level at the end of the fade
+    byte position;      //step along the curve, 0 to SM16188_FADE_CURVE_STEPS
+    uint16_t remainder; //refreshes * position carried over, see stepFade()
+    uint16_t refreshes; //length of the fade, 0 when not fading
+};
+
+//Fade progress (0 to SM16188_FADE_CURVE_STEPS) to share of the level change (0 to 255), ease in and out
+#define SM16188_FADE_CURVE_STEPS 32
+
+//Longest fade in refreshes, about 18 minutes at 60 refreshes a second
+#define SM16188_FADE_MAX_REFRESHES 65535UL
+static const uint8_t sm16188FadeCurve[SM16188_FADE_CURVE_STEPS + 1] PROGMEM = {
+    0, 1, 2, 5, 10, 15, 21, 29, 37, 47, 57, 67, 79, 90, 103, 115, 127,
+    140, 152, 165, 176, 188, 198, 208, 218, 226, 234, 240, 245, 250, 253, 254, 255};
+
+//Clip rectangle in display pixels (inclusive) and origin of the drawing coordinates, see pushClip()
+struct SM16188Clip
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+    int originX;
+    int originY;
+};
+
+//Reads the glyph data of a FONT_FLAG_RLE font byte by byte. The data of every compressed
+//glyph is a run of control bytes, each followed by its data:
+//  0x00-0x7F  (n & 0x7F) + 1 literal bytes follow
+//  0x80-0xBF  the next byte repeated (n & 0x3F) + 2 times
+//  0xC0-0xFF  (n & 0x3F) + 1 zero bytes
+struct SM16188RleReader
+{
+    const uint8_t *data; //next byte of the compressed data
+    uint8_t count;       //bytes left in the current run
+    uint8_t value;       //byte repeated by the current run
+    bool literal;        //current run is literal bytes
+
+    void begin(const uint8_t *glyph)
+    {
+        data = glyph;
+        count = 0;
+        value = 0;
+        literal = false;
+    }
+
+    uint8_t next()
+    {
+        if (!count)
+            control();
+        count--;
+        return literal ? pgm_read_byte(data++) : value;
+    }
+
+    //Skip n bytes of the decompressed data, a whole run at a time
+    void skip(uint16_t n)
+    {
+        while (n)
+        {
+            if (!count)
+                control();
+            uint8_t take = n < count ? n : count;
+            count -= take;
+            n -= take;
+            if (literal)
+                data += take;
+        }
+    }
+
+    void control()
+    {
+        uint8_t n = pgm_read_byte(data++);
+        literal = n < 0x80;
+        if (literal)
+        {
+            count = n + 1;
+        }
+        else if (n < 0xC0)
+        {
+            count = (n & 0x3F) + 2;
+            value = pgm_read_byte(data++);
+        }
+        else
+        {
+            count = (n & 0x3F) + 1;
+            value = 0;
+        }
+    }
+};
+
+//Number of clips pushClip() can nest
+#ifndef SM16188_CLIP_DEPTH
+#define SM16188_CLIP_DEPTH 4
+#endif
+
+//Runtime statistics, see SM16188Stats. Define SM16188_STATS 1 before including sm16188.h to keep
+//them; otherwise the counting compiles out.
+#ifndef SM16188_STATS
+#define SM16188_STATS 0
+#endif
+
+//Write paths counted by SM16188Stats::pixels
+#define STATS_PIXEL 0  //writePixel() and writePixelGray(): outlines, lines, test patterns
+#define STATS_SPAN 1   //byte masks of boxes, axis-aligned lines, filled shapes and clearScreen()
+#define STATS_GLYPH 2  //text
+#define STATS_BITMAP 3 //drawBitmap()
+#define STATS_KINDS 4
+
+//Cycle counter used by the statistics: the CPU cycle count on ESP32, micros() scaled to F_CPU
+//elsewhere (4 us steps on AVR)
+inline unsigned long sm16188Cycles()
+{
+#ifdef ESP32
+    return ESP.getCycleCount();
+#else
+    return micros() * (F_CPU / 1000000UL);
+#endif
+}
+
+#if SM16188_STATS
+//Statistics kept with SM16188_STATS, see stats(). Times are CPU cycles, F_CPU a second.
+struct SM16188Stats
+{
+    unsigned long updateCycles;           //last frame sent by updateScreen() or updateScreenStep(), encoding included
+    unsigned long updateCyclesMax;        //longest of them
+    unsigned long updateCyclesAverage;    //average of them, over about the last 16
+    unsigned long interruptsOffCyclesMax; //longest time the refresh kept interrupts off
+    unsigned int framesPerSecond;         //frames sent during the last whole second
+    unsigned long pixels[STATS_KINDS];    //pixels written between the last two frames sent, by STATS_* write path
+    unsigned long clippedWrites;          //writePixel() and writePixelGray() calls outside the clip
+};
 #endif
+
+//drawArc(): length its start and end directions are scaled to, and a row beyond any display
+#define SM16188_ARC_SCALE 1024
+#define SM16188_ARC_FAR 32767L
+
+//Framebuffer, transmit buffer and routing table storage, a static array when the
+//geometry is fixed at compile time
+template <class T, unsigned int count>
+struct SM16188Buffer
+{
+    T ram[count];
+
+    T *allocate(unsigned int)
+    {
+        return ram;
+    }
+};
+
+//Storage allocated by begin() for a geometry chosen at run time
+template <class T>
+struct SM16188Buffer<T, 0>
+{
+    T *allocate(unsigned int count)
+    {
+        return (T *)malloc(count * sizeof(T));
+    }
+};
+
+//The main class of SM16188 library functions. Give fixedWide and fixedHigh to fix the
+//panel layout at compile time: the framebuffer, transmit buffer, routing table and shown
+//panels are then static and all geometry is constant. fixedDouble adds a static back buffer
+//for double buffering, which otherwise comes from the heap. Grayscale planes always do.
+template <sm16188_pin_t d1, sm16188_pin_t d2, byte fixedWide = 0, byte fixedHigh = 0, bool fixedDouble = false>
 class SM16188
 {
+    static_assert((fixedWide == 0) == (fixedHigh == 0), "fix both panel counts or neither");
+    static_assert(fixedWide || !fixedDouble, "a static back buffer needs a fixed panel layout");
+
 public:
-    void begin(byte panelsWide, byte panelsHigh)
+    //With doubleBuffer, drawing goes to a back buffer that is shown by swapBuffers().
+    //The panels are routed as CHAIN_ROWS, see setChainLayout() for other wiring.
+    //Returns false if the framebuffers could not be allocated.
+    bool begin(byte wide, byte high, bool doubleBuffer = false)
     {
-        _panelsWide = panelsWide;
-        _panelsHigh = panelsHigh;
-        _brightness = 15;
-
-        panelsTotal = _panelsWide * _panelsHigh;
-        bSM16188ScreenRAM = (byte *)malloc(panelsTotal * SM16188_RAM_SIZE_BYTES);
+        _panelsWide = fixedWide ? fixedWide : wide;
+        _panelsHigh = fixedHigh ? fixedHigh : high;
+        memset(_halfFades, 0, sizeof(_halfFades));
+        _fadesActive = 0;
+        setBrightness(15);
+        _grayBits = 1;
+        _grayPlane = 0;
+        _grayTick = 0;
+        _grayRAM = NULL;
+        _keepAlive = SM16188_KEEPALIVE_CALLS;
+        _skippedSinceSent = 0;
+        _refreshTicks = 0;
+        _framesSent = 0;
+        _sendPhase = SEND_IDLE;
+        _stepping = false;
+        _framesSkipped = 0;
+
+        bool allocated = true;
+        bSM16188ScreenRAM = _buffer.allocate(panelsTotal() * SM16188_RAM_SIZE_BYTES);
+        _doubleBuffered = doubleBuffer && bSM16188ScreenRAM;
+        if (_doubleBuffered)
+        {
+            bSM16188DisplayRAM = _displayBuffer.allocate(panelsTotal() * SM16188_RAM_SIZE_BYTES);
+            if (bSM16188DisplayRAM)
+                memset(bSM16188DisplayRAM, 0, panelsTotal() * SM16188_RAM_SIZE_BYTES);
+            else
+                _doubleBuffered = allocated = false;
+        }
+        if (!_doubleBuffered)
+        {
+            bSM16188DisplayRAM = bSM16188ScreenRAM;
+        }
+#if SM16188_TX_BUFFER
+        bSM16188TxRAM = _txBuffer.allocate(SM16188_TX_BYTES(panelsTotal()));
+        bool encoded = bSM16188TxRAM != NULL;
+#else
+        bool encoded = true;
+#endif
+        _routes = _routeBuffer.allocate(panelsTotal());
+        _panelsShown = _shownBuffer.allocate(panelsTotal());
+        if (!bSM16188ScreenRAM || !encoded || !_routes || !_panelsShown)
+        {
+            // out of memory, a display without panels draws and sends nothing
+            _panelsWide = _panelsHigh = 0;
+            allocated = false;
+        }
+        else
+        {
+            setChainLayout(CHAIN_ROWS);
+            memset(_panelsShown, true, panelsTotal());
+        }
+        _frontDirty = true;
+        _clipDepth = 0;
+        resetClip();
 
         pinMode(d1, OUTPUT);
         pinMode(d2, OUTPUT);
         digitalWrite(d1, LOW);
         digitalWrite(d2, LOW);
+#ifdef __AVR__
+        _port[0] = portOutputRegister(digitalPinToPort(d1));
+        _mask[0] = digitalPinToBitMask(d1);
+        _port[1] = portOutputRegister(digitalPinToPort(d2));
+        _mask[1] = digitalPinToBitMask(d2);
+#endif
         // fastPinConfig(d1, OUTPUT, LOW);
         // fastPinConfig(d2, OUTPUT, LOW);
 
         clearScreen(true);
+#if SM16188_STATS
+        resetStats();
+#endif
+        return allocated;
+    }
+
+    //Begin a display whose geometry is fixed by the template parameters, double buffered if
+    //it has a static back buffer
+    bool begin(bool doubleBuffer = fixedDouble)
+    {
+        return begin(fixedWide, fixedHigh, doubleBuffer);
+    }
+
+    //Route the panels for one of the CHAIN_* wirings (combined with |). The routing table is
+    //built here once, so the refresh streams bytes in chain order without address math.
+    void setChainLayout(byte chainLayout)
+    {
+        unsigned int position = 0;
+        for (byte row = 0; row < panelsHigh(); row++)
+        {
+            byte y = (chainLayout & CHAIN_BOTTOM_UP) ? panelsHigh() - 1 - row : row;
+            bool reversed = (chainLayout & CHAIN_SERPENTINE) && (row & 1);
+            for (byte column = 0; column < panelsWide(); column++)
+            {
+                byte x = reversed ? panelsWide() - 1 - column : column;
+                setPanelRoute(position++, x, y, reversed && (chainLayout & CHAIN_ROTATE_RETURN));
+            }
+        }
+    }
+
+    //Wire the panel at chain position (0 is nearest the controller) to panel column x and
+    //row y of the display, for layouts the CHAIN_* options of begin() do not cover
+    void setPanelRoute(unsigned int position, byte x, byte y, bool rotated)
+    {
+        if (position >= panelsTotal() || x >= panelsWide() || y >= panelsHigh())
+            return;
+        unsigned int columnBytes = 2 * panelsHigh();
+        // a rotated panel is sent from its left column and lower half, otherwise from its right column and upper half
+        if (rotated)
+            _routes[position].start = x * SM16188_PIXELS_ACROSS * columnBytes + y * 2 + 1;
+        else
+            _routes[position].start = ((x + 1) * SM16188_PIXELS_ACROSS - 1) * columnBytes + y * 2;
+        _routes[position].panel = y * panelsWide() + x;
+        _routes[position].rotated = rotated;
+        _frontDirty = true;
+    }
+
+    //Display geometry in panels, compile time constants when fixed by the template parameters
+    inline byte panelsWide() const
+    {
+        return fixedWide ? fixedWide : _panelsWide;
+    }
+
+    inline byte panelsHigh() const
+    {
+        return fixedHigh ? fixedHigh : _panelsHigh;
+    }
+
+    inline unsigned int panelsTotal() const
+    {
+        return panelsWide() * panelsHigh();
     }
 
     void end()
@@ -96,30 +519,334 @@ public:
         // fastPinMode(d2, INPUT);
     }
 
-    //Set brightness from 0 to 15
-    void setBrightness(uint8_t brightness)
+    //Set brightness from 0 to 15, the current gain of every chip on the HALF_* data lines given
+    void setBrightness(uint8_t brightness, byte halves = HALF_BOTH)
     {
         if (brightness > 15)
         {
-            _brightness = 15;
+            brightness = 15;
         }
-        else
+        for (byte half = 0; half < 2; half++)
+        {
+            if (halves & (HALF_UPPER << half))
+                setLevel(_halfFades[half], brightness);
+        }
+    }
+
+    //Fade the brightness of the HALF_* data lines given to a level from 0 to 15 over this many
+    //refreshes (updateScreen() or updateScreenStep() frames, sent or skipped), without blocking.
+    //Fades last at most SM16188_FADE_MAX_REFRESHES, longer ones are cut to that.
+    void fadeBrightness(uint8_t brightness, unsigned long refreshes, byte halves = HALF_BOTH)
+    {
+        for (byte half = 0; half < 2; half++)
         {
-            _brightness = brightness;
+            if (halves & (HALF_UPPER << half))
+                startFade(_halfFades[half], brightness, refreshes);
         }
     }
 
+    //Blank one panel (level 0) or show it at the brightness of its halves (any other level).
+    //The chips have a single current gain per data line, shared by every panel on it, so a
+    //panel cannot be dimmed on its own. The framebuffer is left untouched.
+    void setPanelBrightness(byte x, byte y, uint8_t level)
+    {
+        if (x >= panelsWide() || y >= panelsHigh())
+            return;
+        bool &shown = _panelsShown[y * panelsWide() + x];
+        if (shown == (level != 0))
+            return;
+        shown = level != 0;
+        _frontDirty = true;
+    }
+
+    //True while a brightness fade is in progress
+    bool fading()
+    {
+        return _fadesActive != 0;
+    }
+
+    //Resend an unchanged frame after this many skipped updateScreen() calls (0 never resends)
+    void setKeepAlive(unsigned int calls)
+    {
+        _keepAlive = calls;
+    }
+
+    //Force the next updateScreen() to send the frame
+    void invalidate()
+    {
+        _frontDirty = true;
+    }
+
+    //Show the back buffer, atomically with respect to updateScreen(). With copyFrame the new back
+    //buffer starts as a copy of the shown frame, otherwise it holds the frame shown before.
+    //Without SM16188_TX_BUFFER a frame in flight streams from the shown buffer, so the rest of
+    //it is sent first, with interrupts off; do not call this from an interrupt handler then.
+    void swapBuffers(bool copyFrame = false)
+    {
+        if (!_doubleBuffered)
+            return;
+        noInterrupts();
+#if !SM16188_TX_BUFFER
+        unsigned long locked = statsClock();
+        while (!sendNext())
+        {
+        }
+        countInterruptsOff(locked);
+#endif
+        byte *shown = bSM16188DisplayRAM;
+        bSM16188DisplayRAM = bSM16188ScreenRAM;
+        bSM16188ScreenRAM = shown;
+        _frontDirty = true;
+        _dirty = false;
+        interrupts();
+        if (copyFrame)
+            memcpy(bSM16188ScreenRAM, bSM16188DisplayRAM, panelsTotal() * SM16188_RAM_SIZE_BYTES);
+    }
+
+    //Block until the next refresh (a frame sent or skipped) has completed. Only for updateScreen()
+    //or updateScreenStep() driven by a timer interrupt.
+    void waitForRefresh()
+    {
+        byte tick = _refreshTicks;
+        while (tick == _refreshTicks)
+        {
+        }
+    }
+
+    //Number of refreshes (frames sent or skipped) completed, wrapping at 256
+    byte refreshTicks()
+    {
+        return _refreshTicks;
+    }
+
+    //Number of frames clocked out by updateScreen()
+    unsigned long framesSent()
+    {
+        noInterrupts();
+        unsigned long frames = _framesSent;
+        interrupts();
+        return frames;
+    }
+
+    //Number of updateScreen() calls skipped because the frame had not changed
+    unsigned long framesSkipped()
+    {
+        noInterrupts();
+        unsigned long frames = _framesSkipped;
+        interrupts();
+        return frames;
+    }
+
+#if SM16188_STATS
+    //Runtime statistics, copied with interrupts off
+    SM16188Stats stats()
+    {
+        noInterrupts();
+        SM16188Stats copy = _stats;
+        interrupts();
+        return copy;
+    }
+
+    //Start the statistics over
+    void resetStats()
+    {
+        noInterrupts();
+        memset(&_stats, 0, sizeof(_stats));
+        memset(_statsPixels, 0, sizeof(_statsPixels));
+        _statsFrameCycles = 0;
+        _statsSecondStart = millis();
+        _statsSecondFrames = 0;
+        interrupts();
+    }
+#endif
+
+    //Grayscale with 2 to 4 bits per pixel, stored as bit planes (1 turns it off). The 1 bpp drawing
+    //functions draw into the most significant plane, writePixelGray() sets every plane.
+    //Each refresh shows one plane, plane k for 2^k refreshes in a row, so a cycle through all
+    //levels takes 2^bits - 1 refreshes and sends bits frames; see grayLoad() for the cost.
+    //Not available with double buffering. Returns false if the planes could not be allocated.
+    bool setGrayscale(byte bits)
+    {
+        if (bits < 1 || bits > 4 || (bits > 1 && _doubleBuffered))
+            return false;
+        free(_grayRAM);
+        _grayRAM = NULL;
+        _grayBits = 1;
+        _grayPlane = 0;
+        _grayTick = 0;
+        if (bits > 1)
+        {
+            _grayRAM = (byte *)malloc((bits - 1) * panelsTotal() * SM16188_RAM_SIZE_BYTES);
+            if (!_grayRAM)
+                return false;
+            memset(_grayRAM, 0, (bits - 1) * panelsTotal() * SM16188_RAM_SIZE_BYTES);
+            _grayBits = bits;
+            _grayPlane = bits - 1;
+        }
+        _frontDirty = true;
+        return true;
+    }
+
+    //Set a pixel to a gray level from 0 (off) to 2^bits - 1 (full), see setGrayscale()
+    void writePixelGray(unsigned int bX, unsigned int bY, byte level)
+    {
+        int x = (int)bX + _clip.originX;
+        int y = (int)bY + _clip.originY;
+        if (x < _clip.x1 || x > _clip.x2 || y < _clip.y1 || y > _clip.y2)
+        {
+            countClipped();
+            return;
+        }
+        bX = x;
+        bY = y;
+        countPixels(STATS_PIXEL, 1);
+        unsigned int uiSM16188RAMPointer = bX * 2 * panelsHigh() + bY / SM16188_HALF_PIXELS_DOWN;
+        byte mask = 1 << (bY % SM16188_HALF_PIXELS_DOWN);
+        for (byte plane = 0; plane < _grayBits; plane++)
+        {
+            byte &ram = grayPlaneRAM(plane)[uiSM16188RAMPointer];
+            if (level & (1 << plane))
+                ram |= mask;
+            else
+                ram &= ~mask;
+        }
+        markDirty();
+    }
+
+    //Bit plane shown by the last refresh, the most significant is bits - 1
+    byte grayPlane()
+    {
+        return _grayPlane;
+    }
+
+    //Time on the wire of one frame in microseconds, at the calibrated bit timing
+    unsigned long frameMicros()
+    {
+        unsigned long bits = 2 * (8 * (txLineBytes() - 1) + 4);
+        return bits * SM16188_CYCLES_TO_NS(SM16188_T0H_CYCLES + SM16188_T0L_CYCLES) / 1000;
+    }
+
+    //Percentage of CPU time spent sending frames, interrupts off, for grayscale with this many
+    //bits when the refresh runs refreshHz times a second. The levels cycle at
+    //refreshHz / (2^bits - 1), which should stay well above the flicker threshold.
+    unsigned int grayLoad(byte bits, unsigned int refreshHz)
+    {
+        unsigned long framesPerSecond = (unsigned long)refreshHz * bits / ((1 << bits) - 1);
+        return framesPerSecond * frameMicros() / 10000;
+    }
+
+#if SM16188_TX_BUFFER
+    //Encode the shown frame and brightness into txBuffer(). updateScreen() does this itself
+    //whenever the frame or brightness has changed; call it directly to feed a DMA or RMT
+    //style peripheral instead.
+    void encodeFrame()
+    {
+        const byte *frame = shownFrame();
+        byte *stream = bSM16188TxRAM;
+        int columnBytes = 2 * panelsHigh();
+        for (byte line = 0; line < 2; line++)
+        {
+            // the panel furthest along the chain comes first; d2 drives the lower half of
+            // each panel and d1 the upper half, which is the other way up when rotated
+            for (int position = panelsTotal() - 1; position >= 0; position--)
+            {
+                const SM16188Route &route = _routes[position];
+                if (!_panelsShown[route.panel])
+                {
+                    memset(stream, 0, SM16188_PIXELS_ACROSS);
+                    stream += SM16188_PIXELS_ACROSS;
+                }
+                else if (route.rotated)
+                {
+                    const byte *ram = frame + route.start - (line == 0 ? 1 : 0);
+                    for (byte column = 0; column < SM16188_PIXELS_ACROSS; column++, ram += columnBytes)
+                    {
+                        *stream++ = reverseBits(*ram);
+                    }
+                }
+                else
+                {
+                    const byte *ram = frame + route.start + (line == 0 ? 1 : 0);
+                    for (byte column = 0; column < SM16188_PIXELS_ACROSS; column++, ram -= columnBytes)
+                    {
+                        *stream++ = *ram;
+                    }
+                }
+            }
+            *stream++ = _halfFades[line == 0 ? 1 : 0].level << 4;
+        }
+    }
+
+    //Transmit stream of the last encoded frame: txLineBytes() bytes for d2, then as many for d1.
+    //Each line is its chain data, sent most significant bit first, then a trailer byte whose
+    //high nibble is the 4 bit brightness; only those 4 bits of the trailer are sent.
+    const byte *txBuffer() const
+    {
+        return bSM16188TxRAM;
+    }
+#endif
+
+    unsigned int txLineBytes() const
+    {
+        return SM16188_TX_LINE_BYTES(panelsTotal());
+    }
+
+    //Framebuffer the drawing functions write to, column by column from the left: 2 * panelsHigh()
+    //bytes per column, bit y % 8 of byte y / 8 is the pixel at row y
+    const byte *frameBuffer() const
+    {
+        return bSM16188ScreenRAM;
+    }
+
+    //Restrict all drawing to the w by h box at x,y, which also becomes the origin (0,0) of the
+    //drawing coordinates until popClip(). Clips nest: x,y are relative to the current origin and
+    //the box is cut to the current clip. Returns false when SM16188_CLIP_DEPTH clips are pushed.
+    //clearScreen(), the marquee and the test patterns always use the whole display.
+    bool pushClip(int x, int y, int w, int h)
+    {
+        if (_clipDepth >= SM16188_CLIP_DEPTH)
+            return false;
+        _clipStack[_clipDepth++] = _clip;
+        x += _clip.originX;
+        y += _clip.originY;
+        _clip.originX = x;
+        _clip.originY = y;
+        if (x > _clip.x1)
+            _clip.x1 = x;
+        if (y > _clip.y1)
+            _clip.y1 = y;
+        if (x + w - 1 < _clip.x2)
+            _clip.x2 = x + w - 1;
+        if (y + h - 1 < _clip.y2)
+            _clip.y2 = y + h - 1;
+        return true;
+    }
+
+    //Return to the clip and origin in use before the last pushClip()
+    void popClip()
+    {
+        if (_clipDepth > 0)
+            _clip = _clipStack[--_clipDepth];
+    }
+
     //Set or clear a pixel at the x and y location (0,0 is the top left corner)
     void writePixel(unsigned int bX, unsigned int bY, byte bGraphicsMode, byte bPixel)
     {
         unsigned int uiSM16188RAMPointer;
 
-        if (bX >= (SM16188_PIXELS_ACROSS * _panelsWide) || bY >= (SM16188_PIXELS_DOWN * _panelsHigh))
+        // coordinates are relative to the clip origin, see pushClip()
+        int x = (int)bX + _clip.originX;
+        int y = (int)bY + _clip.originY;
+        if (x < _clip.x1 || x > _clip.x2 || y < _clip.y1 || y > _clip.y2)
         {
+            countClipped();
             return;
         }
+        bX = x;
+        bY = y;
+        countPixels(STATS_PIXEL, 1);
 
-        uiSM16188RAMPointer = bX * 2 * _panelsHigh + int(bY / SM16188_HALF_PIXELS_DOWN);
+        uiSM16188RAMPointer = bX * 2 * panelsHigh() + int(bY / SM16188_HALF_PIXELS_DOWN);
 
         bY = bY - SM16188_HALF_PIXELS_DOWN * int(bY / SM16188_HALF_PIXELS_DOWN);
 
@@ -158,34 +885,41 @@ public:
                 bitClear(bSM16188ScreenRAM[uiSM16188RAMPointer], bY); // zero bit is pixel off
             break;
         }
+        markDirty();
     }
 
     //Draw a string
     void drawString(int bX, int bY, const char *bChars, byte length, byte bGraphicsMode)
     {
-        if (bX >= (SM16188_PIXELS_ACROSS * _panelsWide) || bY >= SM16188_PIXELS_DOWN * _panelsHigh)
+        if (bX > clipRight() || bY > clipBottom())
             return;
         uint8_t height = pgm_read_byte(this->Font + FONT_HEIGHT);
-        if (bY + height < 0)
+        if (bY + height < clipTop())
             return;
 
         int strWidth = 0;
-        this->drawLine(bX - 1, bY, bX - 1, bY + height, GRAPHICS_INVERSE);
+        if (bX - 1 >= clipLeft())
+            this->drawLine(bX - 1, bY, bX - 1, bY + height, GRAPHICS_INVERSE);
 
-        for (int i = 0; i < length; i++)
+        for (int i = 0; i < length;)
         {
-            int charWide = this->drawChar(bX + strWidth, bY, bChars[i], bGraphicsMode);
+            // characters left of the clip, scrolled out of a marquee, only advance by their width
+            uint16_t c = nextChar(bChars, i, length);
+            int charWide = codePointWidth(c);
+            if (bX + strWidth + charWide >= clipLeft())
+                charWide = this->drawCodePoint(bX + strWidth, bY, c, bGraphicsMode);
             if (charWide > 0)
             {
                 strWidth += charWide;
-                this->drawLine(bX + strWidth, bY, bX + strWidth, bY + height, GRAPHICS_INVERSE);
+                if (bX + strWidth >= clipLeft())
+                    this->drawLine(bX + strWidth, bY, bX + strWidth, bY + height, GRAPHICS_INVERSE);
                 strWidth++;
             }
             else if (charWide < 0)
             {
                 return;
             }
-            if ((bX + strWidth) >= SM16188_PIXELS_ACROSS * _panelsWide || bY >= SM16188_PIXELS_DOWN * _panelsHigh)
+            if ((bX + strWidth) > clipRight())
                 return;
         }
     }
@@ -194,14 +928,58 @@ public:
     void selectFont(const uint8_t *font)
     {
         this->Font = font;
+        fontHeight = pgm_read_byte(this->Font + FONT_HEIGHT);
+        fontFirstChar = pgm_read_byte(this->Font + FONT_FIRST_CHAR);
+        fontCharCount = pgm_read_byte(this->Font + FONT_CHAR_COUNT);
+        fontRangeCount = 0;
+        fontCompressed = false;
+        fontAligned = false;
+
+        // zero length is flag indicating fixed width font (array does not contain width data entries)
+        fontFixedWidth = 0;
+        if (fontFirstChar == 0 && fontCharCount == 0)
+        {
+            // no characters: a font with a range table, see FONT_RANGE_TABLE
+            fontRangeCount = pgm_read_byte(this->Font + FONT_RANGE_COUNT);
+            fontCompressed = pgm_read_byte(this->Font + FONT_FLAGS) & FONT_FLAG_RLE;
+            fontAligned = pgm_read_byte(this->Font + FONT_FLAGS) & FONT_FLAG_ALIGNED;
+            fontGlyphCount = fontWord(FONT_GLYPH_COUNT);
+            fontWidthTable = FONT_RANGE_TABLE + fontRangeCount * FONT_RANGE_SIZE;
+            for (uint16_t g = 0; g < fontGlyphCount && g < SM16188_WIDTH_CACHE_SIZE; g++)
+                glyphWidth[g] = pgm_read_byte(this->Font + fontWidthTable + g);
+        }
+        else if (pgm_read_byte(this->Font + FONT_LENGTH) == 0 && pgm_read_byte(this->Font + FONT_LENGTH + 1) == 0)
+        {
+            fontFixedWidth = pgm_read_byte(this->Font + FONT_FIXED_WIDTH);
+        }
+        else
+        {
+            // cache the widths and sum the width table once, so text functions do not have to
+            // read them from flash for every glyph
+            uint16_t index = 0;
+            for (uint16_t c = 0; c < fontCharCount; c++)
+            {
+                uint8_t width = pgm_read_byte(this->Font + FONT_WIDTH_TABLE + c);
+                if (c < SM16188_WIDTH_CACHE_SIZE)
+                    glyphWidth[c] = width;
+                if (c % SM16188_GLYPH_INDEX_STEP == 0 && c < SM16188_GLYPH_INDEX_SIZE * SM16188_GLYPH_INDEX_STEP)
+                    glyphIndex[c / SM16188_GLYPH_INDEX_STEP] = index;
+                index += width;
+            }
+        }
     }
 
     //Draw a single character
     int drawChar(const int bX, const int bY, const unsigned char letter, byte bGraphicsMode)
     {
-        if (bX > (SM16188_PIXELS_ACROSS * _panelsWide) || bY > (SM16188_PIXELS_DOWN * _panelsHigh))
+        return drawCodePoint(bX, bY, letter, bGraphicsMode);
+    }
+
+    //Draw a single Unicode character, for fonts with a range table
+    int drawCodePoint(const int bX, const int bY, const uint16_t c, byte bGraphicsMode)
+    {
+        if (bX > clipRight() + 1 || bY > clipBottom() + 1)
             return -1;
-        unsigned char c = letter;
         uint8_t height = pgm_read_byte(this->Font + FONT_HEIGHT);
         if (c == ' ')
         {
@@ -210,282 +988,313 @@ public:
             return charWide;
         }
         uint8_t width = 0;
-        uint8_t bytes = (height + 7) / 8;
-
-        uint8_t firstChar = pgm_read_byte(this->Font + FONT_FIRST_CHAR);
-        uint8_t charCount = pgm_read_byte(this->Font + FONT_CHAR_COUNT);
-
         uint16_t index = 0;
+        bool compressed;
 
-        if (c < firstChar || c >= (firstChar + charCount))
+        if (!findGlyph(c, index, width, compressed))
             return 0;
-        c -= firstChar;
-
-        if (pgm_read_byte(this->Font + FONT_LENGTH) == 0 && pgm_read_byte(this->Font + FONT_LENGTH + 1) == 0)
-        {
-            // zero length is flag indicating fixed width font (array does not contain width data entries)
-            width = pgm_read_byte(this->Font + FONT_FIXED_WIDTH);
-            index = c * bytes * width + FONT_WIDTH_TABLE;
-        }
-        else
-        {
-            // variable width font, read width data, to get the index
-            for (uint8_t i = 0; i < c; i++)
-            {
-                index += pgm_read_byte(this->Font + FONT_WIDTH_TABLE + i);
-            }
-            index = index * bytes + charCount + FONT_WIDTH_TABLE;
-            width = pgm_read_byte(this->Font + FONT_WIDTH_TABLE + c);
-        }
-        if (bX < -width || bY < -height)
-            return width;
+        if (bX < clipLeft() - width || bY < clipTop() - height)
+            return width;
 
         // last but not least, draw the character
-        for (uint8_t j = 0; j < width; j++)
-        { // Width
-            for (uint8_t i = bytes - 1; i < 254; i--)
-            { // Vertical Bytes
-                uint8_t data = pgm_read_byte(this->Font + index + j + (i * width));
-                int offset = (i * 8);
-                if ((i == bytes - 1) && bytes > 1)
-                {
-                    offset = height - 8;
-                }
-                for (uint8_t k = 0; k < 8; k++)
-                { // Vertical bits
-                    if ((offset + k >= i * 8) && (offset + k <= height))
-                    {
-                        if (data & (1 << k))
-                        {
-                            writePixel(bX + j, bY + offset + k, bGraphicsMode, true);
-                        }
-                        else
-                        {
-                            writePixel(bX + j, bY + offset + k, bGraphicsMode, false);
-                        }
-                    }
-                }
-            }
-        }
+        drawGlyphColumns(bX, bY, index, width, compressed, 0, width - 1, bGraphicsMode);
         return width;
     }
 
     //Find the width of a character
     int charWidth(const unsigned char letter)
     {
-        unsigned char c = letter;
+        return codePointWidth(letter);
+    }
+
+    //Find the width of a Unicode character, for fonts with a range table
+    int codePointWidth(const uint16_t letter)
+    {
+        uint16_t c = letter;
         // Space is often not included in font so use width of 'n'
         if (c == ' ')
             c = 'n';
-        uint8_t width = 0;
 
-        uint8_t firstChar = pgm_read_byte(this->Font + FONT_FIRST_CHAR);
-        uint8_t charCount = pgm_read_byte(this->Font + FONT_CHAR_COUNT);
+        if (fontRangeCount)
+        {
+            uint16_t glyph;
+            if (!findGlyphNumber(c, glyph))
+                return 0;
+            return glyph < SM16188_WIDTH_CACHE_SIZE ? glyphWidth[glyph] : pgm_read_byte(this->Font + fontWidthTable + glyph);
+        }
+        if (c < fontFirstChar || c >= (fontFirstChar + fontCharCount))
+        {
+            return 0;
+        }
+        c -= fontFirstChar;
+
+        if (fontFixedWidth)
+            return fontFixedWidth;
+        if (c < SM16188_WIDTH_CACHE_SIZE)
+            return glyphWidth[c];
+        return pgm_read_byte(this->Font + FONT_WIDTH_TABLE + c);
+    }
 
-        // uint16_t index = 0;
+    //Width in pixels of a string as drawString() draws it, without the blank column either side
+    int measureString(const char *bChars, byte length)
+    {
+        int width = 0;
+        for (int i = 0; i < length;)
+            width += textAdvance(nextChar(bChars, i, length));
+        return width > 0 ? width - 1 : 0;
+    }
 
-        if (c < firstChar || c >= (firstChar + charCount))
+    //Draw a string aligned (ALIGN_LEFT, ALIGN_CENTER or ALIGN_RIGHT) in the w pixels from x
+    void drawStringAligned(int bX, int bY, int w, const char *bChars, byte length, byte align, byte bGraphicsMode)
+    {
+        if (align != ALIGN_LEFT)
         {
-            return 0;
+            int space = w - measureString(bChars, length);
+            bX += align == ALIGN_CENTER ? space / 2 : space;
         }
-        c -= firstChar;
+        drawString(bX, bY, bChars, length, bGraphicsMode);
+    }
 
-        if (pgm_read_byte(this->Font + FONT_LENGTH) == 0 && pgm_read_byte(this->Font + FONT_LENGTH + 1) == 0)
+    //Draw text word wrapped in the box w by h at x,y, with each line aligned as in drawStringAligned().
+    //Lines break at spaces and at '\n', words wider than the box are broken anywhere, and only
+    //lines whose full height fits are drawn. Nothing is drawn outside the box. Returns the number
+    //of characters laid out, so the rest can be shown on a next page.
+    int drawTextBox(int bX, int bY, int w, int h, const char *bChars, byte length, byte align, byte bGraphicsMode)
+    {
+        bool clipped = pushClip(bX, bY, w, h);
+        if (!clipped)
         {
-            // zero length is flag indicating fixed width font (array does not contain width data entries)
-            width = pgm_read_byte(this->Font + FONT_FIXED_WIDTH);
+            // out of clip levels: draw in place, still within the current clip
+            w += bX;
+            h += bY;
         }
-        else
+        int top = clipped ? 0 : bY;
+        int left = clipped ? 0 : bX;
+        int i = 0;
+        while (i < length && top + fontHeight <= h)
         {
-            // variable width font, read width data
-            width = pgm_read_byte(this->Font + FONT_WIDTH_TABLE + c);
+            while (i < length && bChars[i] == ' ')
+                i++;
+
+            // take characters until the line overflows, remembering the last break before a space
+            int start = i;
+            int end = i;
+            int width = 0;
+            int breakEnd = -1;
+            int breakWidth = 0;
+            while (i < length && bChars[i] != '\n')
+            {
+                if (bChars[i] == ' ' && bChars[i - 1] != ' ')
+                {
+                    breakEnd = i;
+                    breakWidth = width;
+                }
+                int next = i;
+                int advance = textAdvance(nextChar(bChars, next, length));
+                if (width + advance - 1 > w - left && i > start)
+                    break;
+                width += advance;
+                i = next;
+            }
+            end = i;
+            if (i < length && bChars[i] != '\n' && breakEnd > start)
+            {
+                // overflowed: wrap at the last space, or mid word when there was none
+                end = i = breakEnd;
+                width = breakWidth;
+            }
+            else if (i < length && bChars[i] == '\n')
+            {
+                i++;
+            }
+
+            int x = left;
+            if (align != ALIGN_LEFT && width > 0)
+            {
+                int space = w - left - (width - 1);
+                x += align == ALIGN_CENTER ? space / 2 : space;
+            }
+            drawString(x, top, bChars + start, end - start, bGraphicsMode);
+            top += fontHeight + 1;
         }
-        return width;
+        if (clipped)
+            popClip();
+        return i;
     }
 
-    //Draw a scrolling string (not implemented!)
+    //Draw a scrolling string, then move it with stepMarquee()
     void drawMarquee(const char *bChars, byte length, int left, int top)
     {
         marqueeWidth = 0;
-        for (int i = 0; i < length; i++)
-        {
-            marqueeText[i] = bChars[i];
-            marqueeWidth += charWidth(bChars[i]) + 1;
-        }
+        for (int i = 0; i < length;)
+            marqueeWidth += textAdvance(nextChar(bChars, i, length));
+        memcpy(marqueeText, bChars, length);
         marqueeHeight = pgm_read_byte(this->Font + FONT_HEIGHT);
         marqueeText[length] = '\0';
         marqueeOffsetY = top;
         marqueeOffsetX = left;
         marqueeLength = length;
+        marqueeEdgeChar = 0;
+        marqueeEdgeStart = 0;
+
+        // the marquee uses the whole display
+        SM16188Clip clip = _clip;
+        resetClip();
         drawString(marqueeOffsetX, marqueeOffsetY, marqueeText, marqueeLength,
                    GRAPHICS_NORMAL);
+        _clip = clip;
     }
 
-    //Move the maquee accross by amount
-    // boolean stepMarquee(int amountX, int amountY)
-    // {
-    //     boolean ret = false;
-    //     marqueeOffsetX += amountX;
-    //     marqueeOffsetY += amountY;
-    //     if (marqueeOffsetX < -marqueeWidth)
-    //     {
-    //         marqueeOffsetX = SM16188_PIXELS_ACROSS * _panelsWide;
-    //         clearScreen(true);
-    //         ret = true;
-    //     }
-    //     else if (marqueeOffsetX > SM16188_PIXELS_ACROSS * _panelsWide)
-    //     {
-    //         marqueeOffsetX = -marqueeWidth;
-    //         clearScreen(true);
-    //         ret = true;
-    //     }
-
-    //     if (marqueeOffsetY < -marqueeHeight)
-    //     {
-    //         marqueeOffsetY = SM16188_PIXELS_DOWN * _panelsHigh;
-    //         clearScreen(true);
-    //         ret = true;
-    //     }
-    //     else if (marqueeOffsetY > SM16188_PIXELS_DOWN * _panelsHigh)
-    //     {
-    //         marqueeOffsetY = -marqueeHeight;
-    //         clearScreen(true);
-    //         ret = true;
-    //     }
-
-    //     // Special case horizontal scrolling to improve speed
-    //     if (amountY == 0 && amountX == -1)
-    //     {
-    //         // Shift entire screen one bit
-    //         for (int i = 1; i < SM16188_RAM_SIZE_BYTES * panelsTotal; i++)
-    //         {
-    //             if ((i % (_panelsWide * 4)) == (_panelsWide * 4) - 1)
-    //             {
-    //                 bSM16188ScreenRAM[i] = (bSM16188ScreenRAM[i] << 1) + 1;
-    //             }
-    //             else
-    //             {
-    //                 bSM16188ScreenRAM[i] = (bSM16188ScreenRAM[i] << 1) + ((bSM16188ScreenRAM[i + 1] & 0x80) >> 7);
-    //             }
-    //         }
-
-    //         // Redraw last char on screen
-    //         int strWidth = marqueeOffsetX;
-    //         for (byte i = 0; i < marqueeLength; i++)
-    //         {
-    //             int wide = charWidth(marqueeText[i]);
-    //             if (strWidth + wide >= _panelsWide * SM16188_PIXELS_ACROSS)
-    //             {
-    //                 drawChar(strWidth, marqueeOffsetY, marqueeText[i], GRAPHICS_NORMAL);
-    //                 return ret;
-    //             }
-    //             strWidth += wide + 1;
-    //         }
-    //     }
-    //     else if (amountY == 0 && amountX == 1)
-    //     {
-    //         // Shift entire screen one bit
-    //         for (int i = (SM16188_RAM_SIZE_BYTES * panelsTotal) - 1; i >= 0; i--)
-    //         {
-    //             if ((i % (_panelsWide * 4)) == 0)
-    //             {
-    //                 bSM16188ScreenRAM[i] = (bSM16188ScreenRAM[i] >> 1) + 128;
-    //             }
-    //             else
-    //             {
-    //                 bSM16188ScreenRAM[i] = (bSM16188ScreenRAM[i] >> 1) + ((bSM16188ScreenRAM[i - 1] & 1) << 7);
-    //             }
-    //         }
-
-    //         // Redraw last char on screen
-    //         int strWidth = marqueeOffsetX;
-    //         for (byte i = 0; i < marqueeLength; i++)
-    //         {
-    //             int wide = charWidth(marqueeText[i]);
-    //             if (strWidth + wide >= 0)
-    //             {
-    //                 drawChar(strWidth, marqueeOffsetY, marqueeText[i], GRAPHICS_NORMAL);
-    //                 return ret;
-    //             }
-    //             strWidth += wide + 1;
-    //         }
-    //     }
-    //     else
-    //     {
-    //         drawString(marqueeOffsetX, marqueeOffsetY, marqueeText, marqueeLength,
-    //                    GRAPHICS_NORMAL);
-    //     }
-
-    //     return ret;
-    // }
-
-    //Clear the screen in SM16188 RAM
-    void clearScreen(byte bNormal)
-    {
-        if (bNormal) // clear all pixels
-            memset(bSM16188ScreenRAM, 0, SM16188_RAM_SIZE_BYTES * panelsTotal);
-        else // set all pixels
-            memset(bSM16188ScreenRAM, 255, SM16188_RAM_SIZE_BYTES * panelsTotal);
-    }
-
-    //Draw or clear a line from x1,y1 to x2,y2
-    void drawLine(int x1, int y1, int x2, int y2, byte bGraphicsMode)
+    //Move the marquee across by amount, returns true when it wrapped around the display.
+    //Single column horizontal steps shift the whole display by one column and draw only the
+    //newly exposed column, so their cost does not depend on the length of the text.
+    bool stepMarquee(int amountX, int amountY)
     {
-        int dy = y2 - y1;
-        int dx = x2 - x1;
-        int stepx, stepy;
+        bool ret = false;
+        marqueeOffsetX += amountX;
+        marqueeOffsetY += amountY;
+        if (marqueeOffsetX < -marqueeWidth)
+        {
+            marqueeOffsetX = SM16188_PIXELS_ACROSS * panelsWide();
+            clearScreen(true);
+            ret = true;
+        }
+        else if (marqueeOffsetX > SM16188_PIXELS_ACROSS * panelsWide())
+        {
+            marqueeOffsetX = -marqueeWidth;
+            clearScreen(true);
+            ret = true;
+        }
 
-        if (dy < 0)
+        if (marqueeOffsetY < -marqueeHeight)
         {
-            dy = -dy;
-            stepy = -1;
+            marqueeOffsetY = SM16188_PIXELS_DOWN * panelsHigh();
+            clearScreen(true);
+            ret = true;
         }
-        else
+        else if (marqueeOffsetY > SM16188_PIXELS_DOWN * panelsHigh())
+        {
+            marqueeOffsetY = -marqueeHeight;
+            clearScreen(true);
+            ret = true;
+        }
+
+        // the marquee uses the whole display
+        SM16188Clip clip = _clip;
+        resetClip();
+
+        // Special case horizontal scrolling to improve speed
+        unsigned int columnBytes = 2 * panelsHigh();
+        unsigned int lastColumn = SM16188_PIXELS_ACROSS * panelsWide() - 1;
+        if (amountY == 0 && amountX == -1)
         {
-            stepy = 1;
+            // Shift entire screen one column left
+            memmove(bSM16188ScreenRAM, bSM16188ScreenRAM + columnBytes, lastColumn * columnBytes);
+            drawMarqueeColumn(lastColumn, lastColumn - marqueeOffsetX);
         }
-        if (dx < 0)
+        else if (amountY == 0 && amountX == 1)
         {
-            dx = -dx;
-            stepx = -1;
+            // Shift entire screen one column right
+            memmove(bSM16188ScreenRAM + columnBytes, bSM16188ScreenRAM, lastColumn * columnBytes);
+            drawMarqueeColumn(0, -marqueeOffsetX);
         }
         else
         {
-            stepx = 1;
+            clearScreen(true);
+            drawString(marqueeOffsetX, marqueeOffsetY, marqueeText, marqueeLength,
+                       GRAPHICS_NORMAL);
         }
-        dy <<= 1; // dy is now 2*dy
-        dx <<= 1; // dx is now 2*dx
 
-        writePixel(x1, y1, bGraphicsMode, true);
-        if (dx > dy)
+        _clip = clip;
+        return ret;
+    }
+
+    //Clear the screen in SM16188 RAM
+    void clearScreen(byte bNormal)
+    {
+        // every grayscale plane, so the pixels end up off or at full level
+        for (byte plane = 0; plane < _grayBits; plane++)
+            memset(grayPlaneRAM(plane), bNormal ? 0 : 255, SM16188_RAM_SIZE_BYTES * panelsTotal());
+        markDirty();
+        countPixels(STATS_SPAN, 8UL * SM16188_RAM_SIZE_BYTES * panelsTotal());
+    }
+
+    //Clear (bNormal true) or set all pixels of the box from x1,y1 to x2,y2
+    void clearBox(int x1, int y1, int x2, int y2, byte bNormal)
+    {
+        drawFilledBoxOp(x1, y1, x2, y2, bNormal ? SPAN_CLEAR : SPAN_SET);
+    }
+
+    //Draw or clear a line from x1,y1 to x2,y2
+    void drawLine(int x1, int y1, int x2, int y2, byte bGraphicsMode)
+    {
+        // axis-aligned lines are written a byte at a time
+        if (x1 == x2)
         {
-            int fraction = dy - (dx >> 1); // same as 2*dy - dx
-            while (x1 != x2)
-            {
-                if (fraction >= 0)
-                {
-                    y1 += stepy;
-                    fraction -= dx; // same as fraction -= 2*dx
-                }
-                x1 += stepx;
-                fraction += dy; // same as fraction -= 2*dy
-                writePixel(x1, y1, bGraphicsMode, true);
-            }
+            drawFilledBoxOp(x1, y1, x2, y2, spanOp(bGraphicsMode, true));
+            return;
         }
-        else
+        if (y1 == y2)
+        {
+            drawFilledBoxOp(x1, y1, x2, y2, spanOp(bGraphicsMode, true));
+            return;
+        }
+
+        // Cohen-Sutherland outcodes: nothing to do when both ends are beyond the same edge
+        if (outcode(x1, y1) & outcode(x2, y2))
+            return;
+
+        // Bresenham along the major axis a, stepping the minor axis b. Only the steps between
+        // where the line enters and leaves the clip are walked, starting from the state the
+        // full walk would have there, so the pixels are the same as unclipped.
+        bool xMajor = abs(x2 - x1) > abs(y2 - y1);
+        int a = xMajor ? x1 : y1;
+        int b = xMajor ? y1 : x1;
+        int stepA = (xMajor ? x2 - x1 : y2 - y1) < 0 ? -1 : 1;
+        int stepB = (xMajor ? y2 - y1 : x2 - x1) < 0 ? -1 : 1;
+        long steps = xMajor ? abs(x2 - x1) : abs(y2 - y1);
+        long majorDelta = steps << 1;
+        long minorDelta = (long)(xMajor ? abs(y2 - y1) : abs(x2 - x1)) << 1;
+        long fraction = minorDelta - (majorDelta >> 1);
+
+        // steps with a inside the clip
+        int aLow = xMajor ? clipLeft() : clipTop();
+        int aHigh = xMajor ? clipRight() : clipBottom();
+        long first = stepA > 0 ? aLow - a : a - aHigh;
+        long last = stepA > 0 ? aHigh - a : a - aLow;
+
+        // and with b inside it: b has moved by m(k) after k steps, which never decreases
+        int bLow = xMajor ? clipTop() : clipLeft();
+        int bHigh = xMajor ? clipBottom() : clipRight();
+        long enter = lineStepFor(stepB > 0 ? bLow - b : b - bHigh, fraction, majorDelta, minorDelta);
+        long leave = lineStepFor((stepB > 0 ? bHigh - b : b - bLow) + 1, fraction, majorDelta, minorDelta) - 1;
+        if (first < enter)
+            first = enter;
+        if (last > leave)
+            last = leave;
+        if (first < 0)
+            first = 0;
+        if (last > steps)
+            last = steps;
+        if (first > last)
+            return;
+
+        long moved = lineMovedAt(first, fraction, majorDelta, minorDelta);
+        fraction += first * minorDelta - moved * majorDelta;
+        a += stepA * first;
+        b += stepB * moved;
+        for (long k = first;; k++)
         {
-            int fraction = dx - (dy >> 1);
-            while (y1 != y2)
+            writePixel(xMajor ? a : b, xMajor ? b : a, bGraphicsMode, true);
+            if (k == last)
+                break;
+            if (fraction >= 0)
             {
-                if (fraction >= 0)
-                {
-                    x1 += stepx;
-                    fraction -= dy;
-                }
-                y1 += stepy;
-                fraction += dx;
-                writePixel(x1, y1, bGraphicsMode, true);
+                b += stepB;
+                fraction -= majorDelta;
             }
+            a += stepA;
+            fraction += minorDelta;
         }
     }
 
@@ -496,6 +1305,17 @@ public:
         int y = radius;
         int p = (5 - radius * 4) / 4;
 
+        int r = radius < 0 ? -radius : radius;
+        if (!boxVisible(xCenter - r, yCenter - r, xCenter + r, yCenter + r))
+            return;
+
+        // nor if the clip is inside the hole: every point of the circle is at least r - 1 from the
+        // centre, so it misses a clip whose farthest corner is nearer
+        long farX = xCenter - clipLeft() > clipRight() - xCenter ? xCenter - clipLeft() : clipRight() - xCenter;
+        long farY = yCenter - clipTop() > clipBottom() - yCenter ? yCenter - clipTop() : clipBottom() - yCenter;
+        if (r > 1 && farX * farX + farY * farY < (long)(r - 1) * (r - 1))
+            return;
+
         drawCircleSub(xCenter, yCenter, x, y, bGraphicsMode);
         while (x < y)
         {
@@ -516,6 +1336,16 @@ public:
     //Draw or clear a box(rectangle) with a single pixel border
     void drawBox(int x1, int y1, int x2, int y2, byte bGraphicsMode)
     {
+        // nothing to do if the box misses the clip or the clip is inside it
+        int left = x1 < x2 ? x1 : x2;
+        int right = x1 < x2 ? x2 : x1;
+        int top = y1 < y2 ? y1 : y2;
+        int bottom = y1 < y2 ? y2 : y1;
+        if (!boxVisible(left, top, right, bottom))
+            return;
+        if (left < clipLeft() && right > clipRight() && top < clipTop() && bottom > clipBottom())
+            return;
+
         drawLine(x1, y1, x2, y1, bGraphicsMode);
         drawLine(x2, y1, x2, y2, bGraphicsMode);
         drawLine(x2, y2, x1, y2, bGraphicsMode);
@@ -525,10 +1355,210 @@ public:
     //Draw or clear a filled box(rectangle) with a single pixel border
     void drawFilledBox(int x1, int y1, int x2, int y2, byte bGraphicsMode)
     {
-        for (int b = x1; b <= x2; b++)
+        if (x1 > x2)
+            return;
+        drawFilledBoxOp(x1, y1, x2, y2, spanOp(bGraphicsMode, true));
+    }
+
+    //Draw or clear a filled circle of radius r at x,y centre, covering the drawCircle() outline
+    void drawFilledCircle(int xCenter, int yCenter, int radius, byte bGraphicsMode)
+    {
+        drawFilledEllipse(xCenter, yCenter, radius, radius, bGraphicsMode);
+    }
+
+    //Draw or clear a filled ellipse with radii xRadius across and yRadius down at x,y centre
+    void drawFilledEllipse(int xCenter, int yCenter, int xRadius, int yRadius, byte bGraphicsMode)
+    {
+        int a = xRadius < 0 ? -xRadius : xRadius;
+        int b = yRadius < 0 ? -yRadius : yRadius;
+        if (!boxVisible(xCenter - a, yCenter - b, xCenter + a, yCenter + b))
+            return;
+        byte op = spanOp(bGraphicsMode, true);
+        if (a == 0 || b == 0)
+        {
+            drawFilledBoxOp(xCenter - a, yCenter - b, xCenter + a, yCenter + b, op);
+            return;
+        }
+
+        // one span per column, only for the columns inside the clip
+        int x1 = xCenter - a < clipLeft() ? clipLeft() : xCenter - a;
+        int x2 = xCenter + a > clipRight() ? clipRight() : xCenter + a;
+        int h = b;
+        for (int x = x1; x <= x2; x++)
+        {
+            h = ellipseHalfHeight(x - xCenter, a, b, h);
+            columnSpanOp(x, yCenter - h, yCenter + h, op);
+        }
+    }
+
+    //Draw or clear a filled box(rectangle) from x1,y1 to x2,y2 with corners rounded to radius,
+    //which is reduced to fit the box
+    void drawFilledRoundBox(int x1, int y1, int x2, int y2, int radius, byte bGraphicsMode)
+    {
+        int left = x1 < x2 ? x1 : x2;
+        int right = x1 < x2 ? x2 : x1;
+        int top = y1 < y2 ? y1 : y2;
+        int bottom = y1 < y2 ? y2 : y1;
+        if (!boxVisible(left, top, right, bottom))
+            return;
+        byte op = spanOp(bGraphicsMode, true);
+        int r = radius < 0 ? 0 : radius;
+        if (r > (right - left) / 2)
+            r = (right - left) / 2;
+        if (r > (bottom - top) / 2)
+            r = (bottom - top) / 2;
+
+        // the straight middle is one box, the columns of the rounded ends are inset by the
+        // quarter circles of the corners
+        drawFilledBoxOp(left + r, top, right - r, bottom, op);
+        int h = r;
+        for (int c = r; c > 0; c--)
+        {
+            h = circleHalfHeight(c, r, h);
+            if (left + r - c >= clipLeft() && left + r - c <= clipRight())
+                columnSpanOp(left + r - c, top + r - h, bottom - r + h, op);
+            if (right - r + c >= clipLeft() && right - r + c <= clipRight())
+                columnSpanOp(right - r + c, top + r - h, bottom - r + h, op);
+        }
+    }
+
+    //Draw or clear an arc of a ring around x,y centre: the pixels of the filled circle of radius
+    //that are not in the one of radius - thickness, from startAngle clockwise to endAngle. Angles
+    //are degrees clockwise from 12 o'clock; the whole ring is drawn when they are 360 or more
+    //apart, nothing when they are equal. Use thickness radius + 1 for a pie slice.
+    void drawArc(int xCenter, int yCenter, int radius, int thickness, int startAngle, int endAngle, byte bGraphicsMode)
+    {
+        if (radius < 0 || thickness <= 0)
+            return;
+        if (!boxVisible(xCenter - radius, yCenter - radius, xCenter + radius, yCenter + radius))
+            return;
+        byte op = spanOp(bGraphicsMode, true);
+        int inner = radius - thickness;
+
+        // the start and end directions, scaled to integers; which pixels of a column are inside
+        // the arc follows from the sides of them the pixels are on
+        long sweep = (long)endAngle - startAngle;
+        bool ring = sweep >= 360 || sweep <= -360;
+        sweep = ((sweep % 360) + 360) % 360;
+        if (sweep == 0 && !ring)
+            return;
+        long startX = lround(sin(startAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+        long startY = lround(-cos(startAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+        long endX = lround(sin(endAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+        long endY = lround(-cos(endAngle * (M_PI / 180)) * SM16188_ARC_SCALE);
+
+        int x1 = xCenter - radius < clipLeft() ? clipLeft() : xCenter - radius;
+        int x2 = xCenter + radius > clipRight() ? clipRight() : xCenter + radius;
+        int outerHeight = radius;
+        int innerHeight = inner;
+        for (int x = x1; x <= x2; x++)
+        {
+            long dx = x - xCenter;
+            outerHeight = circleHalfHeight(dx, radius, outerHeight);
+            innerHeight = inner >= 0 ? circleHalfHeight(dx, inner, innerHeight) : -1;
+
+            // up to two runs of the column are in the ring, and up to two in the angle
+            int ringTop[2] = {-outerHeight, innerHeight + 1};
+            int ringBottom[2] = {innerHeight < 0 ? outerHeight : -innerHeight - 1, outerHeight};
+            long angleTop[2] = {-SM16188_ARC_FAR, -SM16188_ARC_FAR};
+            long angleBottom[2] = {SM16188_ARC_FAR, -SM16188_ARC_FAR - 1};
+            if (ring)
+            {
+                // everything
+            }
+            else if (sweep <= 180)
+            {
+                // clockwise of the start and anticlockwise of the end
+                halfPlaneRun(startX, startY, dx, false, angleTop[0], angleBottom[0]);
+                halfPlaneRun(-endX, -endY, dx, false, angleTop[0], angleBottom[0]);
+            }
+            else
+            {
+                // outside of the part clockwise of the end and anticlockwise of the start
+                long top = -SM16188_ARC_FAR;
+                long bottom = SM16188_ARC_FAR;
+                halfPlaneRun(endX, endY, dx, true, top, bottom);
+                halfPlaneRun(-startX, -startY, dx, true, top, bottom);
+                if (top <= bottom)
+                {
+                    angleBottom[0] = top - 1;
+                    angleTop[1] = bottom + 1;
+                    angleBottom[1] = SM16188_ARC_FAR;
+                }
+            }
+            for (byte r = 0; r < (innerHeight < 0 ? 1 : 2); r++)
+            {
+                for (byte g = 0; g < 2; g++)
+                {
+                    long top = ringTop[r] > angleTop[g] ? ringTop[r] : angleTop[g];
+                    long bottom = ringBottom[r] < angleBottom[g] ? ringBottom[r] : angleBottom[g];
+                    if (top <= bottom)
+                        columnSpanOp(x, yCenter + top, yCenter + bottom, op);
+                }
+            }
+        }
+    }
+
+    //Draw a 1 bpp bitmap with its top left corner at x, y (which may be off screen). The bitmap is
+    //column-major like the framebuffer: (height + 7) / 8 bytes per column, least significant bit
+    //at the top. Set bits are drawn as writePixel() draws bPixel true, clear bits as false.
+    //Pass inProgmem false for a bitmap in RAM.
+    void drawBitmap(int x, int y, const uint8_t *bitmap, uint8_t width, uint8_t height, byte bGraphicsMode, bool inProgmem = true)
+    {
+        // clipped once, to the visible columns and bands
+        x += _clip.originX;
+        y += _clip.originY;
+        int first = x < _clip.x1 ? _clip.x1 - x : 0;
+        int last = x + width - 1 > _clip.x2 ? _clip.x2 - x : width - 1;
+        if (first > last || y > _clip.y2 || y + height <= _clip.y1)
+            return;
+
+        uint8_t bands = (height + 7) / 8;
+        int columnBytes = 2 * panelsHigh();
+        for (uint8_t i = 0; i < bands; i++)
         {
-            drawLine(b, y1, b, y2, bGraphicsMode);
+            // bits k with y + i * 8 + k inside the bitmap and the clip are drawn
+            int top = y + i * 8;
+            int lo = _clip.y1 - top;
+            int hi = _clip.y2 - top;
+            if (i == bands - 1 && (height & 7) && hi > (height & 7) - 1)
+                hi = (height & 7) - 1;
+            if (lo < 0)
+                lo = 0;
+            if (hi > 7)
+                hi = 7;
+            if (lo > hi)
+                continue;
+            byte mask = (0xFF << lo) & (0xFF >> (7 - hi));
+
+            // rows above the display are shifted out of the byte
+            byte clip = 0;
+            if (top < 0)
+            {
+                if (top <= -8)
+                    continue;
+                clip = -top;
+                mask >>= clip;
+                top = 0;
+            }
+            int row = top / SM16188_HALF_PIXELS_DOWN;
+            if (row >= columnBytes)
+                break;
+            byte shift = top & 7;
+            bool split = shift && row + 1 < columnBytes;
+
+            countPixels(STATS_BITMAP, (unsigned long)(last - first + 1) * maskPixels(mask));
+            const uint8_t *data = bitmap + first * bands + i;
+            byte *column = bSM16188ScreenRAM + (x + first) * columnBytes + row;
+            for (int j = first; j <= last; j++, data += bands, column += columnBytes)
+            {
+                byte bits = (inProgmem ? pgm_read_byte(data) : *data) >> clip;
+                writeMaskedByte(column[0], bits << shift, mask << shift, bGraphicsMode);
+                if (split)
+                    writeMaskedByte(column[1], bits >> (8 - shift), mask >> (8 - shift), bGraphicsMode);
+            }
         }
+        markDirty();
     }
 
     //Draw the selected test pattern
@@ -536,8 +1566,8 @@ public:
     {
         unsigned int ui;
 
-        unsigned int numPixels = panelsTotal * SM16188_PIXELS_ACROSS * SM16188_PIXELS_DOWN;
-        unsigned int pixelsWide = SM16188_PIXELS_ACROSS * _panelsWide;
+        unsigned int numPixels = panelsTotal() * SM16188_PIXELS_ACROSS * SM16188_PIXELS_DOWN;
+        unsigned int pixelsWide = SM16188_PIXELS_ACROSS * panelsWide();
         for (ui = 0; ui < numPixels; ui++)
         {
             switch (bPattern)
@@ -568,218 +1598,1031 @@ public:
         }
     }
 
-    // Insert the calls to this function into the main loop for the highest call rate, or from a timer interrupt
+    // Insert the calls to this function into the main loop for the highest call rate, or from a timer interrupt.
+    // Only a changed frame is clocked out, plus a keep-alive resend (see setKeepAlive()).
+    // Called from an interrupt that lands between two bytes of updateScreenStep(), it does nothing.
     void updateScreen()
     {
+        if (_stepping)
+            return; // updateScreenStep() was interrupted and finishes its own frame
+        unsigned long started = statsClock();
+        if (_sendPhase != SEND_IDLE)
+        {
+            // finish the frame started by updateScreenStep()
+            noInterrupts();
+            unsigned long locked = statsClock();
+            while (!sendNext())
+            {
+            }
+            countInterruptsOff(locked);
+            interrupts();
+            countFrame(started);
+            return;
+        }
+        if (!startFrame())
+            return;
+
         noInterrupts();
-        for (int i = SM16188_PIXELS_ACROSS * _panelsWide * 2 - 1; i >= 0; i -= 2)
+        unsigned long locked = statsClock();
+#if SM16188_TX_BUFFER
+        const byte *stream = bSM16188TxRAM;
+        const byte *trailer = stream + txLineBytes() - 1;
+        while (stream != trailer)
+        {
+            transfer(*stream++, d2);
+        }
+        transferBrightness(*stream++, d2);
+        trailer += txLineBytes();
+        while (stream != trailer)
         {
-            transfer(bSM16188ScreenRAM[i], d2);
+            transfer(*stream++, d1);
         }
-        transferBrightness(_brightness, d2);
-        for (int i = SM16188_PIXELS_ACROSS * _panelsWide * 2 - 2; i >= 0; i -= 2)
+        transferBrightness(*stream, d1);
+#else
+        unsigned int last = txLineBytes() - 1;
+        for (unsigned int index = 0; index < last; index++)
         {
-            transfer(bSM16188ScreenRAM[i], d1);
+            transfer(streamByte(0, index), d2);
         }
-        transferBrightness(_brightness, d1);
+        transferBrightness(streamByte(0, last), d2);
+        for (unsigned int index = 0; index < last; index++)
+        {
+            transfer(streamByte(1, index), d1);
+        }
+        transferBrightness(streamByte(1, last), d1);
+#endif
+        _sendPhase = SEND_IDLE;
+        _refreshTicks++;
+        countInterruptsOff(locked);
         interrupts();
+        countFrame(started);
     }
 
-private:
-#ifdef __AVR__
-    inline __attribute__((always_inline)) void transfer(byte val, uint8_t pin)
+    // Time-sliced updateScreen(): sends at most maxBytes bytes of the frame per call (each
+    // 4 bit brightness trailer counts as one) and keeps interrupts off only for
+    // SM16188_STEP_LOCK_BYTES bytes at a time. Returns true once the frame is complete,
+    // or was skipped as unchanged; the next call then starts a new frame.
+    // Calls must follow each other within SM16188_MAX_GAP_US, see docs/timing.md.
+    bool updateScreenStep(unsigned int maxBytes)
     {
-        switch (pin)
+        if (_stepping)
+            return false; // re-entered from an interrupt
+        // set first, so an interrupt cannot start or resend a frame while this one is encoded
+        _stepping = true;
+        if (_sendPhase == SEND_IDLE && !startFrame())
         {
-        case d1:
-            for (int i = 7; i >= 0; i--)
-            {
-                if (bitRead(val, i))
-                {
-                    delay = micros();
-                    fastDigitalWrite(d1, HIGH);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                    fastDigitalWrite(d1, LOW);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                }
-                else
-                {
-                    delay = micros();
-                    fastDigitalWrite(d1, HIGH);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                    fastDigitalWrite(d1, LOW);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                }
-            }
-            break;
-        case d2:
-            for (int i = 7; i >= 0; i--)
-            {
-                if (bitRead(val, i))
-                {
-                    delay = micros();
-                    fastDigitalWrite(d2, HIGH);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                    fastDigitalWrite(d2, LOW);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                }
-                else
-                {
-                    delay = micros();
-                    fastDigitalWrite(d2, HIGH);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                    fastDigitalWrite(d2, LOW);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                }
-            }
-            break;
+            _stepping = false;
+            return true;
         }
-    }
 
-    inline __attribute__((always_inline)) void transferBrightness(byte val, uint8_t pin)
-    {
-        switch (pin)
+        unsigned long started = statsClock();
+        bool done = false;
+        while (maxBytes && !done)
         {
-        case d1:
-            for (int i = 3; i >= 0; i--)
-            {
-                if (bitRead(val, i))
-                {
-                    delay = micros();
-                    fastDigitalWrite(d1, HIGH);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                    fastDigitalWrite(d1, LOW);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                }
-                else
-                {
-                    delay = micros();
-                    fastDigitalWrite(d1, HIGH);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                    fastDigitalWrite(d1, LOW);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                }
-            }
-            break;
-        case d2:
-            for (int i = 3; i >= 0; i--)
+            noInterrupts();
+            unsigned long locked = statsClock();
+            for (byte n = 0; n < SM16188_STEP_LOCK_BYTES && maxBytes && !done; n++, maxBytes--)
             {
-                if (bitRead(val, i))
-                {
-                    delay = micros();
-                    fastDigitalWrite(d2, HIGH);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                    fastDigitalWrite(d2, LOW);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                }
-                else
-                {
-                    delay = micros();
-                    fastDigitalWrite(d2, HIGH);
-                    // while (micros() - delay < 1)
-                    // {
-                    // }
-                    fastDigitalWrite(d2, LOW);
-                    while (micros() - delay < 1)
-                    {
-                    }
-                }
+                done = sendNext();
             }
-            break;
+            countInterruptsOff(locked);
+            interrupts();
         }
+        _stepping = false;
+        if (done)
+            countFrame(started);
+        else
+            countFrameStep(started);
+        return done;
     }
 
-#elif defined(ESP32)
-    inline __attribute__((always_inline)) void transfer(byte val, gpio_num_t pin)
+private:
+    //Flag the frame as changed, after the framebuffer writes of the change and never before: a
+    //refresh that starts in between would send a half drawn frame, clear the flag and lose the
+    //rest until the keep-alive. The barrier keeps the compiler from sinking the writes past it.
+    inline void markDirty()
     {
-        for (int i = 7; i >= 0; i--)
-        {
-            if (bitRead(val, i))
-            {
-                writeData(pin, HIGH);
-            }
-            else
-            {
-                writeData(pin, LOW);
-            }
-        }
+        asm volatile("" ::: "memory");
+        _dirty = true;
+    }
+
+    //Mirror the rows of a column byte, for panels mounted upside down
+    static inline byte reverseBits(byte b)
+    {
+        b = (b >> 4) | (b << 4);
+        b = ((b >> 2) & 0x33) | ((b & 0x33) << 2);
+        return ((b >> 1) & 0x55) | ((b & 0x55) << 1);
+    }
+
+    //Set a fade level at once, cancelling any fade in progress. An unchanged level leaves the
+    //frame as it is, so repeated setBrightness() calls do not resend it.
+    void setLevel(SM16188Fade &fade, byte level)
+    {
+        if (!fade.refreshes && fade.level == level)
+            return;
+        if (fade.refreshes)
+            _fadesActive--;
+        fade.level = fade.from = fade.to = level;
+        fade.refreshes = 0;
+        _frontDirty = true;
     }
 
-    inline __attribute__((always_inline)) void transferBrightness(byte val, gpio_num_t pin)
+    void startFade(SM16188Fade &fade, byte level, unsigned long refreshes)
     {
-        for (int i = 3; i >= 0; i--)
+        if (level > 15)
+            level = 15;
+        if (refreshes == 0 || level == fade.level)
         {
-            if (bitRead(val, i))
-            {
-                writeData(pin, HIGH);
-            }
-            else
-            {
-                writeData(pin, LOW);
-            }
+            setLevel(fade, level);
+            return;
         }
+        if (!fade.refreshes)
+            _fadesActive++;
+        fade.from = fade.level;
+        fade.to = level;
+        fade.position = 0;
+        fade.remainder = 0;
+        fade.refreshes = refreshes > SM16188_FADE_MAX_REFRESHES ? SM16188_FADE_MAX_REFRESHES : refreshes;
     }
 
-    inline __attribute__((always_inline)) void writeData(gpio_num_t pin, bool level)
+    //Advance one fade by a refresh, true if its level changed
+    bool stepFade(SM16188Fade &fade)
     {
-        if (level)
+        if (!fade.refreshes)
+            return false;
+        // position is refreshes done * SM16188_FADE_CURVE_STEPS / refreshes, counted without
+        // dividing, so the fade reaches the end of the curve on exactly its last refresh
+        unsigned long carry = fade.remainder + SM16188_FADE_CURVE_STEPS;
+        while (carry >= fade.refreshes)
         {
-            delay = micros();
-            gpio_set_level(pin, HIGH);
-            while (micros() - delay < 1)
-            {
-            }
-            gpio_set_level(pin, LOW);
-            // while (micros() - delay < 4)
-            // {
-            // }
+            carry -= fade.refreshes;
+            fade.position++;
+        }
+        fade.remainder = carry;
+        byte level;
+        if (fade.position >= SM16188_FADE_CURVE_STEPS)
+        {
+            level = fade.to;
+            fade.refreshes = 0;
+            _fadesActive--;
         }
         else
         {
-            delay = micros();
-            gpio_set_level(pin, HIGH);
-            // while (micros() - delay < 1)
-            // {
-            // }
-            gpio_set_level(pin, LOW);
-            while (micros() - delay < 1)
-            {
-            }
+            int share = pgm_read_byte(&sm16188FadeCurve[fade.position]);
+            level = fade.from + ((fade.to - fade.from) * share + (fade.to > fade.from ? 127 : -127)) / 255;
         }
+        if (level == fade.level)
+            return false;
+        fade.level = level;
+        return true;
     }
 
-#endif
-
-    void
-    drawCircleSub(int cx, int cy, int x, int y, byte bGraphicsMode)
+    //Advance every fade by a refresh and mark the frame changed if a level moved
+    void stepFades()
+    {
+        bool changed = stepFade(_halfFades[0]);
+        changed |= stepFade(_halfFades[1]);
+        if (changed)
+            _frontDirty = true;
+    }
+
+    //Data line of the frame in flight
+    enum
+    {
+        SEND_IDLE,
+        SEND_D2,
+        SEND_D1
+    };
+
+    //Framebuffer of a grayscale plane, the most significant one is the 1 bpp framebuffer
+    inline byte *grayPlaneRAM(byte plane)
+    {
+        if (plane == _grayBits - 1)
+            return bSM16188ScreenRAM;
+        return _grayRAM + plane * panelsTotal() * SM16188_RAM_SIZE_BYTES;
+    }
+
+    //SM16188_STATS bookkeeping. Without it these are empty and compile out, arguments and all.
+    inline unsigned long statsClock()
+    {
+#if SM16188_STATS
+        return sm16188Cycles();
+#else
+        return 0;
+#endif
+    }
+
+    inline void countPixels(byte kind, unsigned long pixels)
+    {
+#if SM16188_STATS
+        _statsPixels[kind] += pixels;
+#else
+        (void)kind;
+        (void)pixels;
+#endif
+    }
+
+    inline void countClipped()
+    {
+#if SM16188_STATS
+        _stats.clippedWrites++;
+#endif
+    }
+
+    //Interrupts have been off since locked
+    inline void countInterruptsOff(unsigned long locked)
+    {
+#if SM16188_STATS
+        unsigned long cycles = sm16188Cycles() - locked;
+        if (cycles > _stats.interruptsOffCyclesMax)
+            _stats.interruptsOffCyclesMax = cycles;
+#else
+        (void)locked;
+#endif
+    }
+
+    //A frame is being sent: the pixels drawn for it and the frame rate
+    inline void countFrameStart()
+    {
+#if SM16188_STATS
+        memcpy(_stats.pixels, _statsPixels, sizeof(_statsPixels));
+        memset(_statsPixels, 0, sizeof(_statsPixels));
+        _statsSecondFrames++;
+        if (millis() - _statsSecondStart >= 1000)
+        {
+            _stats.framesPerSecond = _statsSecondFrames;
+            _statsSecondFrames = 0;
+            _statsSecondStart = millis();
+        }
+#endif
+    }
+
+    //An updateScreenStep() call since started sent part of a frame
+    inline void countFrameStep(unsigned long started)
+    {
+#if SM16188_STATS
+        _statsFrameCycles += sm16188Cycles() - started;
+#else
+        (void)started;
+#endif
+    }
+
+    //The last part of a frame was sent by a call since started
+    inline void countFrame(unsigned long started)
+    {
+#if SM16188_STATS
+        unsigned long cycles = _statsFrameCycles + sm16188Cycles() - started;
+        _statsFrameCycles = 0;
+        _stats.updateCycles = cycles;
+        if (cycles > _stats.updateCyclesMax)
+            _stats.updateCyclesMax = cycles;
+        // moving average with a weight of 1/16 for the new frame
+        _stats.updateCyclesAverage = _stats.updateCyclesAverage ? _stats.updateCyclesAverage - _stats.updateCyclesAverage / 16 + cycles / 16 : cycles;
+#else
+        (void)started;
+#endif
+    }
+
+    //Pixels of a byte mask
+    static inline byte maskPixels(byte mask)
+    {
+        byte pixels = 0;
+        for (; mask; mask &= mask - 1)
+            pixels++;
+        return pixels;
+    }
+
+    //Frame start bookkeeping shared by updateScreen() and updateScreenStep(), false if the frame is skipped
+    bool startFrame()
+    {
+        if (_grayBits > 1)
+        {
+            // plane k is shown on refreshes 2^k - 1 to 2^(k+1) - 2 of the cycle
+            if (++_grayTick == (1 << _grayBits) - 1)
+                _grayTick = 0;
+            byte plane = 0;
+            while ((2 << plane) - 1 <= _grayTick)
+                plane++;
+            if (plane != _grayPlane)
+            {
+                _grayPlane = plane;
+                _frontDirty = true;
+            }
+        }
+        if (_fadesActive)
+            stepFades();
+        bool changed = _frontDirty || (!_doubleBuffered && _dirty);
+#if SM16188_TX_BUFFER
+        bool ready = bSM16188TxRAM != NULL;
+#else
+        bool ready = _routes != NULL;
+#endif
+        if (!ready || (!changed && (_keepAlive == 0 || ++_skippedSinceSent < _keepAlive)))
+        {
+            _framesSkipped++;
+            _refreshTicks++;
+            return false;
+        }
+        // cleared before sending, so a change made during the transfer is sent next time
+        _frontDirty = false;
+        if (!_doubleBuffered)
+            _dirty = false;
+        _skippedSinceSent = 0;
+        _framesSent++;
+        countFrameStart();
+
+#if SM16188_TX_BUFFER
+        // a keep-alive resend reuses the stream already encoded
+        if (changed)
+            encodeFrame();
+#else
+        _sendFrame = shownFrame();
+#endif
+        _sendPhase = SEND_D2;
+        _sendIndex = 0;
+        return true;
+    }
+
+    //Send the next byte or brightness trailer of the frame in flight, true when it was the last
+    //or there is no frame in flight
+    bool sendNext()
+    {
+        if (_sendPhase == SEND_IDLE)
+            return true;
+        unsigned int last = txLineBytes() - 1;
+        if (_sendPhase == SEND_D2)
+        {
+            if (_sendIndex < last)
+            {
+                transfer(streamByte(0, _sendIndex++), d2);
+                return false;
+            }
+            transferBrightness(streamByte(0, last), d2);
+            _sendPhase = SEND_D1;
+            _sendIndex = 0;
+            return false;
+        }
+        if (_sendIndex < last)
+        {
+            transfer(streamByte(1, _sendIndex++), d1);
+            return false;
+        }
+        transferBrightness(streamByte(1, last), d1);
+        _sendPhase = SEND_IDLE;
+        _refreshTicks++;
+        return true;
+    }
+
+    //Byte index of the d2 (line 0) or d1 (line 1) stream of the frame in flight, the brightness
+    //trailer last: from txBuffer(), or without SM16188_TX_BUFFER encoded from the framebuffer
+    //as encodeFrame() would
+    inline byte streamByte(byte line, unsigned int index)
+    {
+#if SM16188_TX_BUFFER
+        return bSM16188TxRAM[line * txLineBytes() + index];
+#else
+        if (index == txLineBytes() - 1)
+            return _halfFades[line == 0 ? 1 : 0].level << 4;
+        const SM16188Route &route = _routes[panelsTotal() - 1 - index / SM16188_PIXELS_ACROSS];
+        if (!_panelsShown[route.panel])
+            return 0;
+        unsigned int column = (index % SM16188_PIXELS_ACROSS) * 2 * panelsHigh();
+        if (route.rotated)
+            return reverseBits(_sendFrame[route.start - (line == 0 ? 1 : 0) + column]);
+        return _sendFrame[route.start + (line == 0 ? 1 : 0) - column];
+#endif
+    }
+
+    //Frame shown by the next refresh: the shown framebuffer or the grayscale plane of its turn
+    inline const byte *shownFrame()
+    {
+        return _grayPlane == _grayBits - 1 ? bSM16188DisplayRAM : grayPlaneRAM(_grayPlane);
+    }
+
+#ifdef __AVR__
+    //Send one byte, most significant bit first
+    inline __attribute__((always_inline)) void transfer(byte val, sm16188_pin_t pin)
+    {
+        sendBits(val, 8, pin == d1 ? 0 : 1);
+    }
+
+    //Send the 4 bit current gain that ends every chain transfer, from the high nibble of a trailer byte
+    inline __attribute__((always_inline)) void transferBrightness(byte val, sm16188_pin_t pin)
+    {
+        sendBits(val, 4, pin == d1 ? 0 : 1);
+    }
+
+    //Send the top bits of val on data line line (0 is d1), with interrupts off. The whole port
+    //is written, read once before the first bit. Instruction cycles on the right, see
+    //SM16188_BIT_T0H_CYCLES: the two skips take 5 cycles either way, so 0 and 1 codes have
+    //the same period, and only the last LOW runs on into the code after the loop.
+    inline __attribute__((always_inline)) void sendBits(byte val, byte bits, byte line)
+    {
+        volatile uint8_t *port = _port[line];
+        byte high = *port | _mask[line];
+        byte low = *port & ~_mask[line];
+        asm volatile(
+            "1:                 \n\t"
+            "st %a[port], %[high] \n\t" // 2  rising edge
+            ".rept %[t0h]       \n\t"   //    pad to T0H
+            "nop                \n\t"
+            ".endr              \n\t"
+            "sbrs %[val], 7     \n\t"   // 1  2 when skipping a 1
+            "st %a[port], %[low] \n\t"  // 2  falling edge of a 0
+            "sbrc %[val], 7     \n\t"   // 2  1 for a 1
+            "rjmp .+0           \n\t"   // 2  only for a 1
+            "lsl %[val]         \n\t"   // 1
+            "dec %[bits]        \n\t"   // 1
+            ".rept %[t1h]       \n\t"   //    pad to T1H
+            "nop                \n\t"
+            ".endr              \n\t"
+            "st %a[port], %[low] \n\t"  // 2  falling edge of a 1
+            ".rept %[t1l]       \n\t"   //    pad to T1L
+            "nop                \n\t"
+            ".endr              \n\t"
+            "brne 1b            \n\t"   // 2
+            : [val] "+r"(val), [bits] "+r"(bits)
+            : [port] "e"(port), [high] "r"(high), [low] "r"(low), [t0h] "I"(SM16188_BIT_T0H_CYCLES - 3),
+              [t1h] "I"(SM16188_BIT_T1H_CYCLES - SM16188_BIT_T0H_CYCLES - 6), [t1l] "I"(SM16188_BIT_T1L_CYCLES - 4)
+            : "memory");
+    }
+
+#else
+    //Send one byte, most significant bit first
+    inline __attribute__((always_inline)) void transfer(byte val, sm16188_pin_t pin)
+    {
+        for (byte mask = 0x80; mask; mask >>= 1)
+        {
+            writeData(pin, val & mask);
+        }
+    }
+
+    //Send the 4 bit current gain that ends every chain transfer, from the high nibble of a trailer byte
+    inline __attribute__((always_inline)) void transferBrightness(byte val, sm16188_pin_t pin)
+    {
+        for (byte mask = 0x80; mask != 0x08; mask >>= 1)
+        {
+            writeData(pin, val & mask);
+        }
+    }
+#endif
+
+#if defined(ESP32)
+    //Both phases are timed against the CPU cycle counter from the rising edge
+    inline __attribute__((always_inline)) void writeData(gpio_num_t pin, bool level)
+    {
+        uint32_t start = ESP.getCycleCount();
+        if (level)
+        {
+            gpio_set_level(pin, HIGH);
+            while (ESP.getCycleCount() - start < SM16188_T1H_CYCLES)
+            {
+            }
+            gpio_set_level(pin, LOW);
+            while (ESP.getCycleCount() - start < SM16188_T1H_CYCLES + SM16188_T1L_CYCLES)
+            {
+            }
+        }
+        else
+        {
+            gpio_set_level(pin, HIGH);
+            while (ESP.getCycleCount() - start < SM16188_T0H_CYCLES)
+            {
+            }
+            gpio_set_level(pin, LOW);
+            while (ESP.getCycleCount() - start < SM16188_T0H_CYCLES + SM16188_T0L_CYCLES)
+            {
+            }
+        }
+    }
+
+#elif defined(SM16188_HOST)
+    //Record the pulse with the widths the bit loop of the target sends, see SM16188_HOST_AVR
+    inline __attribute__((always_inline)) void writeData(uint8_t pin, bool level)
+    {
+        if (level)
+            SM16188Host::instance().pulse(pin, 1, SM16188_CYCLES_TO_NS(SM16188_BIT_T1H_CYCLES), SM16188_CYCLES_TO_NS(SM16188_BIT_T1L_CYCLES));
+        else
+            SM16188Host::instance().pulse(pin, 0, SM16188_CYCLES_TO_NS(SM16188_BIT_T0H_CYCLES), SM16188_CYCLES_TO_NS(SM16188_BIT_T0L_CYCLES));
+    }
+
+#endif
+
+    //Clip covering the whole display, with the origin at its top left corner
+    void resetClip()
+    {
+        _clip.x1 = 0;
+        _clip.y1 = 0;
+        _clip.x2 = SM16188_PIXELS_ACROSS * panelsWide() - 1;
+        _clip.y2 = SM16188_PIXELS_DOWN * panelsHigh() - 1;
+        _clip.originX = 0;
+        _clip.originY = 0;
+    }
+
+    //Edges of the clip in drawing coordinates
+    inline int clipLeft()
+    {
+        return _clip.x1 - _clip.originX;
+    }
+
+    inline int clipRight()
+    {
+        return _clip.x2 - _clip.originX;
+    }
+
+    inline int clipTop()
+    {
+        return _clip.y1 - _clip.originY;
+    }
+
+    inline int clipBottom()
+    {
+        return _clip.y2 - _clip.originY;
+    }
+
+    //Whether any of the box from x1,y1 to x2,y2 (ordered, drawing coordinates) is inside the clip
+    inline bool boxVisible(int x1, int y1, int x2, int y2)
+    {
+        return x2 >= clipLeft() && x1 <= clipRight() && y2 >= clipTop() && y1 <= clipBottom();
+    }
+
+    //Cohen-Sutherland outcode of x,y (drawing coordinates) against the clip: a bit for each
+    //edge it is beyond
+    inline byte outcode(int x, int y)
+    {
+        return (x < clipLeft() ? 1 : 0) | (x > clipRight() ? 2 : 0) | (y < clipTop() ? 4 : 0) | (y > clipBottom() ? 8 : 0);
+    }
+
+    //Times the minor axis of a Bresenham line in drawLine() has moved after k steps, for its
+    //starting fraction and doubled major and minor deltas
+    static long lineMovedAt(long k, long fraction, long majorDelta, long minorDelta)
+    {
+        if (k <= 0)
+            return 0;
+        return floorDiv(fraction + (k - 1) * minorDelta, majorDelta) + 1;
+    }
+
+    //First step at which the minor axis has moved at least t times (past the end of the line
+    //when it never does)
+    static long lineStepFor(long t, long fraction, long majorDelta, long minorDelta)
+    {
+        if (t <= 0)
+            return 0;
+        return 1 + ceilDiv((t - 1) * majorDelta - fraction, minorDelta);
+    }
+
+    //Division rounding down and up, for any sign of n and d > 0
+    static long floorDiv(long n, long d)
+    {
+        return n >= 0 ? n / d : -((-n + d - 1) / d);
+    }
+
+    static long ceilDiv(long n, long d)
+    {
+        return n >= 0 ? (n + d - 1) / d : -(-n / d);
+    }
+
+    //Byte operations equivalent to writePixel() with a given graphics mode and pixel value
+    enum
+    {
+        SPAN_NONE,
+        SPAN_SET,
+        SPAN_CLEAR,
+        SPAN_TOGGLE
+    };
+
+    static byte spanOp(byte bGraphicsMode, byte bPixel)
+    {
+        switch (bGraphicsMode)
+        {
+        case GRAPHICS_NORMAL:
+            return bPixel ? SPAN_SET : SPAN_CLEAR;
+        case GRAPHICS_INVERSE:
+            return bPixel ? SPAN_CLEAR : SPAN_SET;
+        case GRAPHICS_TOGGLE:
+            return bPixel ? SPAN_TOGGLE : SPAN_NONE;
+        case GRAPHICS_OR:
+            return bPixel ? SPAN_SET : SPAN_NONE;
+        case GRAPHICS_NOR:
+            return bPixel ? SPAN_CLEAR : SPAN_NONE;
+        }
+        return SPAN_NONE;
+    }
+
+    static inline void applySpanOp(byte &ram, byte mask, byte op)
+    {
+        switch (op)
+        {
+        case SPAN_SET:
+            ram |= mask;
+            break;
+        case SPAN_CLEAR:
+            ram &= ~mask;
+            break;
+        case SPAN_TOGGLE:
+            ram ^= mask;
+            break;
+        }
+    }
+
+    //Apply op to every pixel from x1,y1 to x2,y2 (corners in any order), clipped to the display
+    void drawFilledBoxOp(int x1, int y1, int x2, int y2, byte op)
+    {
+        if (x1 > x2)
+        {
+            int x = x1;
+            x1 = x2;
+            x2 = x;
+        }
+        if (y1 > y2)
+        {
+            int y = y1;
+            y1 = y2;
+            y2 = y;
+        }
+        x1 += _clip.originX;
+        x2 += _clip.originX;
+        y1 += _clip.originY;
+        y2 += _clip.originY;
+        if (x1 < _clip.x1)
+            x1 = _clip.x1;
+        if (x2 > _clip.x2)
+            x2 = _clip.x2;
+        if (y1 < _clip.y1)
+            y1 = _clip.y1;
+        if (y2 > _clip.y2)
+            y2 = _clip.y2;
+        if (x1 > x2 || y1 > y2)
+            return;
+        if (op == SPAN_NONE)
+        {
+            markDirty();
+            return;
+        }
+        countPixels(STATS_SPAN, (unsigned long)(x2 - x1 + 1) * (y2 - y1 + 1));
+
+        // a column holds 8 vertical pixels per byte, so a span is at most a few masked bytes
+        unsigned int columnBytes = 2 * panelsHigh();
+        unsigned int first = y1 / SM16188_HALF_PIXELS_DOWN;
+        unsigned int last = y2 / SM16188_HALF_PIXELS_DOWN;
+        byte firstMask = 0xFF << (y1 & 7);
+        byte lastMask = 0xFF >> (7 - (y2 & 7));
+        byte *column = bSM16188ScreenRAM + x1 * columnBytes;
+        for (int x = x1; x <= x2; x++, column += columnBytes)
+        {
+            if (first == last)
+            {
+                applySpanOp(column[first], firstMask & lastMask, op);
+                continue;
+            }
+            applySpanOp(column[first], firstMask, op);
+            for (unsigned int b = first + 1; b < last; b++)
+                applySpanOp(column[b], 0xFF, op);
+            applySpanOp(column[last], lastMask, op);
+        }
+        markDirty();
+    }
+
+    //Apply op to the pixels of column x from y1 to y2, nothing when y1 > y2
+    void columnSpanOp(int x, int y1, int y2, byte op)
+    {
+        if (y1 <= y2)
+            drawFilledBoxOp(x, y1, x, y2, op);
+    }
+
+    //Half height of column dx of a filled circle of radius r, which holds the pixels with
+    //dx^2 + dy^2 <= r^2 + r (so every pixel of the drawCircle() outline): the largest such dy,
+    //-1 when the column misses it. h is the value of a nearby column to start from.
+    static int circleHalfHeight(long dx, long r, int h)
+    {
+        long limit = r * r + r - dx * dx;
+        if (limit < 0)
+            return -1;
+        if (h < 0)
+            h = 0;
+        while ((long)h * h > limit)
+            h--;
+        while ((long)(h + 1) * (h + 1) <= limit)
+            h++;
+        return h;
+    }
+
+    //The same for an ellipse with radii a and b, holding the pixels inside the one with radii
+    //a + 1/2 and b + 1/2: 4(2b + 1)^2 dx^2 + 4(2a + 1)^2 dy^2 <= (2a + 1)^2 (2b + 1)^2, which is
+    //the circle above when a == b
+    static int ellipseHalfHeight(long dx, long a, long b, int h)
+    {
+        if (a == b)
+            return circleHalfHeight(dx, a, h);
+        int64_t across = (2 * a + 1) * (2 * a + 1);
+        int64_t down = (2 * b + 1) * (2 * b + 1);
+        int64_t limit = across * down - 4 * down * dx * dx;
+        if (limit < 0)
+            return -1;
+        if (h < 0)
+            h = 0;
+        while (4 * across * h * h > limit)
+            h--;
+        while (4 * across * (h + 1) * (h + 1) <= limit)
+            h++;
+        return h;
+    }
+
+    //Narrow top..bottom to the pixels dy of column dx on the clockwise side of direction vx,vy
+    //(cross product vx * dy - vy * dx >= 0, or > 0 if strict)
+    static void halfPlaneRun(long vx, long vy, long dx, bool strict, long &top, long &bottom)
+    {
+        long n = vy * dx;
+        if (vx == 0)
+        {
+            if (strict ? -n <= 0 : -n < 0)
+                bottom = top - 1;
+            return;
+        }
+        if (vx > 0)
+        {
+            long t = strict ? floorDiv(n, vx) + 1 : ceilDiv(n, vx);
+            if (top < t)
+                top = t;
+        }
+        else
+        {
+            long b = strict ? ceilDiv(-n, -vx) - 1 : floorDiv(-n, -vx);
+            if (bottom > b)
+                bottom = b;
+        }
+    }
+
+    //Little-endian uint16 at offset of the current font
+    uint16_t fontWord(uint16_t offset)
+    {
+        return pgm_read_byte(this->Font + offset) | (pgm_read_byte(this->Font + offset + 1) << 8);
+    }
+
+    //Glyph number of code point c in a font with a range table, by binary search of the ranges
+    bool findGlyphNumber(uint16_t c, uint16_t &glyph)
+    {
+        uint8_t lo = 0;
+        uint8_t hi = fontRangeCount;
+        while (lo < hi)
+        {
+            uint8_t mid = (lo + hi) / 2;
+            uint16_t range = FONT_RANGE_TABLE + mid * FONT_RANGE_SIZE;
+            uint16_t first = fontWord(range);
+            if (c < first)
+                hi = mid;
+            else if (c - first >= fontWord(range + 2))
+                lo = mid + 1;
+            else
+            {
+                glyph = fontWord(range + 4) + (c - first);
+                return glyph < fontGlyphCount;
+            }
+        }
+        return false;
+    }
+
+    //Locate a glyph in the current font and whether its data are RLE compressed, returns false
+    //if the font does not contain it
+    bool findGlyph(uint16_t c, uint16_t &index, uint8_t &width, bool &compressed)
+    {
+        uint8_t bytes = (fontHeight + 7) / 8;
+        uint8_t charCount = fontCharCount;
+
+        index = 0;
+        compressed = false;
+
+        if (fontRangeCount)
+        {
+            uint16_t glyph;
+            if (!findGlyphNumber(c, glyph))
+                return false;
+            width = glyph < SM16188_WIDTH_CACHE_SIZE ? glyphWidth[glyph] : pgm_read_byte(this->Font + fontWidthTable + glyph);
+            if (!fontCompressed)
+            {
+                index = fontWord(fontWidthTable + fontGlyphCount + 2 * glyph);
+                return true;
+            }
+            // from the offset of the glyph's block, past the glyphs before it in the block
+            uint16_t block = glyph / FONT_RLE_BLOCK;
+            uint16_t sizes = fontWidthTable + fontGlyphCount + 2 * ((fontGlyphCount + FONT_RLE_BLOCK - 1) / FONT_RLE_BLOCK);
+            index = fontWord(fontWidthTable + fontGlyphCount + 2 * block);
+            for (uint16_t g = block * FONT_RLE_BLOCK; g < glyph; g++)
+            {
+                uint8_t size = pgm_read_byte(this->Font + sizes + g);
+                index += size ? size : bytes * (g < SM16188_WIDTH_CACHE_SIZE ? glyphWidth[g] : pgm_read_byte(this->Font + fontWidthTable + g));
+            }
+            compressed = pgm_read_byte(this->Font + sizes + glyph) != 0;
+            return true;
+        }
+        if (c < fontFirstChar || c >= (fontFirstChar + charCount))
+            return false;
+        c -= fontFirstChar;
+
+        if (fontFixedWidth)
+        {
+            width = fontFixedWidth;
+            index = c * bytes * width + FONT_WIDTH_TABLE;
+        }
+        else
+        {
+            // variable width font, start from the nearest entry of the glyph index
+            uint8_t entry = c / SM16188_GLYPH_INDEX_STEP;
+            if (entry >= SM16188_GLYPH_INDEX_SIZE)
+                entry = SM16188_GLYPH_INDEX_SIZE - 1;
+            index = glyphIndex[entry];
+            for (uint8_t i = entry * SM16188_GLYPH_INDEX_STEP; i < c; i++)
+            {
+                index += pgm_read_byte(this->Font + FONT_WIDTH_TABLE + i);
+            }
+            index = index * bytes + charCount + FONT_WIDTH_TABLE;
+            width = c < SM16188_WIDTH_CACHE_SIZE ? glyphWidth[c] : pgm_read_byte(this->Font + FONT_WIDTH_TABLE + c);
+        }
+        return true;
+    }
+
+    //Write the pixels selected by mask in one framebuffer byte, as writePixel() would bit by bit
+    static inline void writeMaskedByte(byte &ram, byte data, byte mask, byte bGraphicsMode)
+    {
+        switch (bGraphicsMode)
+        {
+        case GRAPHICS_NORMAL:
+            ram = (ram & ~mask) | (data & mask);
+            break;
+        case GRAPHICS_INVERSE:
+            ram = (ram & ~mask) | (~data & mask);
+            break;
+        case GRAPHICS_TOGGLE:
+            ram ^= data & mask;
+            break;
+        case GRAPHICS_OR:
+            ram |= data & mask;
+            break;
+        case GRAPHICS_NOR:
+            ram &= ~(data & mask);
+            break;
+        }
+    }
+
+    //Draw columns first to last of the glyph at index (see findGlyph()) with its left edge at x.
+    //Every glyph byte is shifted into the one or two framebuffer bytes it covers.
+    void drawGlyphColumns(int x, int y, uint16_t index, uint8_t width, bool compressed, int first, int last, byte bGraphicsMode)
+    {
+        // trimmed to the columns inside the clip
+        x += _clip.originX;
+        y += _clip.originY;
+        if (x + first < _clip.x1)
+            first = _clip.x1 - x;
+        if (x + last > _clip.x2)
+            last = _clip.x2 - x;
+        if (first > last)
+            return;
+
+        uint8_t height = fontHeight;
+        uint8_t bytes = (height + 7) / 8;
+        int columnBytes = 2 * panelsHigh();
+
+        // compressed glyphs are decoded in order, skipping the bytes that are not drawn
+        SM16188RleReader rle;
+        uint16_t decoded = 0;
+        rle.begin(this->Font + index);
+        bool drawn = false;
+
+        for (uint8_t i = 0; i < bytes; i++)
+        { // Vertical Bytes
+            int offset = (i * 8);
+            if ((i == bytes - 1) && bytes > 1 && !fontAligned)
+            {
+                offset = height - 8;
+            }
+            int below = (i == bytes - 1) && bytes > 1 && fontAligned; // keep the row under the glyph, as overlapping bands do
+
+            // bits k with offset + k in [i * 8, height] are drawn, the last byte overlaps the one above
+            // unless the font is aligned, and only those with y + offset + k inside the clip
+            int lo = i * 8 - offset;
+            int hi = height - offset - below;
+            if (lo < _clip.y1 - y - offset)
+                lo = _clip.y1 - y - offset;
+            if (hi > _clip.y2 - y - offset)
+                hi = _clip.y2 - y - offset;
+            if (lo < 0)
+                lo = 0;
+            if (hi > 7)
+                hi = 7;
+            if (lo > hi)
+                continue;
+            byte mask = (0xFF << lo) & (0xFF >> (7 - hi));
+
+            // rows above the display are shifted out of the byte
+            int top = y + offset;
+            byte clip = 0;
+            if (top < 0)
+            {
+                if (top <= -8)
+                    continue;
+                clip = -top;
+                mask >>= clip;
+                top = 0;
+            }
+            int row = top / SM16188_HALF_PIXELS_DOWN;
+            if (row >= columnBytes)
+                continue;
+            byte shift = top & 7;
+            bool split = shift && row + 1 < columnBytes;
+            drawn = true;
+
+            countPixels(STATS_GLYPH, (unsigned long)(last - first + 1) * maskPixels(mask));
+            const uint8_t *data = this->Font + index + (i * width) + first;
+            if (compressed)
+            {
+                rle.skip(i * width + first - decoded);
+                decoded = i * width + last + 1;
+            }
+            byte *column = bSM16188ScreenRAM + (x + first) * columnBytes + row;
+            for (int j = first; j <= last; j++, column += columnBytes)
+            { // Width
+                byte bits = (compressed ? rle.next() : pgm_read_byte(data++)) >> clip;
+                writeMaskedByte(column[0], bits << shift, mask << shift, bGraphicsMode);
+                if (split)
+                    writeMaskedByte(column[1], bits >> (8 - shift), mask >> (8 - shift), bGraphicsMode);
+            }
+        }
+        if (drawn)
+            markDirty();
+    }
+
+    //Next character of bChars from byte i on, advancing i past it: UTF-8 for fonts with a range
+    //table, one byte per character otherwise. Malformed sequences and characters beyond U+FFFF
+    //come out as U+FFFD.
+    uint16_t nextChar(const char *bChars, int &i, int length)
+    {
+        byte b = bChars[i++];
+        if (!fontRangeCount || b < 0x80)
+            return b;
+        byte follow = b >= 0xF0 ? 3 : b >= 0xE0 ? 2 : b >= 0xC0 ? 1 : 0;
+        bool valid = follow == 1 || follow == 2;
+        uint16_t c = b & (0x3F >> follow);
+        for (; follow && i < length && (bChars[i] & 0xC0) == 0x80; follow--)
+            c = (c << 6) | (bChars[i++] & 0x3F);
+        return valid && !follow ? c : 0xFFFD;
+    }
+
+    //Start of the character before byte i of bChars, see nextChar()
+    int prevChar(const char *bChars, int i)
+    {
+        i--;
+        while (fontRangeCount && i > 0 && (bChars[i] & 0xC0) == 0x80)
+            i--;
+        return i;
+    }
+
+    //Columns taken by a character in drawString(), including the separator
+    int textAdvance(uint16_t c)
+    {
+        int width = codePointWidth(c);
+        return width > 0 ? width + 1 : 0;
+    }
+
+    //Clear display column x and draw marquee text column column into it, as drawString() would
+    void drawMarqueeColumn(unsigned int x, int column)
+    {
+        unsigned int columnBytes = 2 * panelsHigh();
+        memset(bSM16188ScreenRAM + x * columnBytes, 0, columnBytes);
+        markDirty();
+        if (column < 0 || column >= marqueeWidth)
+            return;
+
+        // walk to the character under the column, moving from the last one found
+        while (column < marqueeEdgeStart)
+        {
+            marqueeEdgeChar = prevChar(marqueeText, marqueeEdgeChar);
+            int i = marqueeEdgeChar;
+            marqueeEdgeStart -= textAdvance(nextChar(marqueeText, i, marqueeLength));
+        }
+        int next = marqueeEdgeChar;
+        uint16_t c = nextChar(marqueeText, next, marqueeLength);
+        int advance = textAdvance(c);
+        while (column >= marqueeEdgeStart + advance)
+        {
+            marqueeEdgeStart += advance;
+            marqueeEdgeChar = next;
+            c = nextChar(marqueeText, next, marqueeLength);
+            advance = textAdvance(c);
+        }
+
+        // separators and spaces are blank columns
+        int j = column - marqueeEdgeStart;
+        if (c == ' ' || j == advance - 1)
+            return;
+        uint16_t index = 0;
+        uint8_t width = 0;
+        bool compressed;
+        findGlyph(c, index, width, compressed);
+        drawGlyphColumns((int)x - j, marqueeOffsetY, index, width, compressed, j, j, GRAPHICS_NORMAL);
+    }
+
+    void
+    drawCircleSub(int cx, int cy, int x, int y, byte bGraphicsMode)
     {
 
         if (x == 0)
@@ -810,14 +2653,77 @@ private:
     }
 
 private:
-    unsigned long delay;
     byte _panelsWide;
     byte _panelsHigh;
-    byte _brightness;
-    byte panelsTotal;
+
+    //Current gain of the d1 (HALF_UPPER) and d2 (HALF_LOWER) chips, and whether each panel is
+    //shown, by y * panelsWide() + x
+    SM16188Fade _halfFades[2];
+    bool *_panelsShown;
+    byte _fadesActive;
+    SM16188Buffer<byte, fixedWide * fixedHigh * SM16188_RAM_SIZE_BYTES> _buffer;
+    SM16188Buffer<byte, fixedDouble ? fixedWide * fixedHigh * SM16188_RAM_SIZE_BYTES : 0> _displayBuffer;
+#if SM16188_TX_BUFFER
+    SM16188Buffer<byte, fixedWide ? SM16188_TX_BYTES(fixedWide * fixedHigh) : 0> _txBuffer;
+#endif
+    SM16188Buffer<SM16188Route, fixedWide * fixedHigh> _routeBuffer;
+    SM16188Buffer<bool, fixedWide * fixedHigh> _shownBuffer;
+
+    //Panels in chain order, nearest the controller first
+    SM16188Route *_routes;
+
+    //Dirty-frame tracking for updateScreen(), _dirty is set by drawing and _frontDirty when the shown frame changes
+    volatile bool _dirty;
+    volatile bool _frontDirty;
+    volatile byte _refreshTicks;
+    unsigned int _keepAlive;
+    unsigned int _skippedSinceSent;
+    volatile unsigned long _framesSent;
+    volatile unsigned long _framesSkipped;
+
+    //updateScreenStep() progress: SEND_* line and next byte of that line's stream
+    volatile byte _sendPhase;
+    unsigned int _sendIndex;
+    volatile bool _stepping;
+#ifdef __AVR__
+    //Output register and pin mask of d1 and d2, for sendBits()
+    volatile uint8_t *_port[2];
+    byte _mask[2];
+#endif
+
+#if SM16188_STATS
+    //Statistics, pixels written since the last frame was sent, cycles of the frame in flight so
+    //far and frames sent since the current second started
+    SM16188Stats _stats;
+    unsigned long _statsPixels[STATS_KINDS];
+    unsigned long _statsFrameCycles;
+    unsigned long _statsSecondStart;
+    unsigned int _statsSecondFrames;
+#endif
+
+    //Current clip and the ones saved by pushClip()
+    SM16188Clip _clip;
+    SM16188Clip _clipStack[SM16188_CLIP_DEPTH];
+    byte _clipDepth;
 
     //Pointer to current font
     const uint8_t *Font;
+    uint8_t fontHeight;
+
+    //Metrics of the current font cached by selectFont(), fontFixedWidth is 0 for variable width fonts
+    //and fontRangeCount 0 for fonts without a range table. Widths are by glyph number for those.
+    uint8_t fontFirstChar;
+    uint8_t fontCharCount;
+    uint8_t fontFixedWidth;
+    uint8_t fontRangeCount;
+    bool fontCompressed;
+    bool fontAligned;
+    uint16_t fontGlyphCount;
+    uint16_t fontWidthTable;
+    uint8_t glyphWidth[SM16188_WIDTH_CACHE_SIZE];
+
+    //Sum of the widths before every SM16188_GLYPH_INDEX_STEP-th glyph of the current font
+    uint16_t glyphIndex[SM16188_GLYPH_INDEX_SIZE];
 
     //Marquee values
     char marqueeText[256];
@@ -826,9 +2732,239 @@ private:
     int marqueeHeight;
     int marqueeOffsetX;
     int marqueeOffsetY;
+    byte marqueeEdgeChar; //character under the last column drawn by stepMarquee()
+    int marqueeEdgeStart; //text column where that character starts
 
-    //Mirror of SM16188 pixels in RAM, ready to be clocked out by the main loop or high speed timer calls
+    //Mirror of SM16188 pixels in RAM that all drawing goes to
     byte *bSM16188ScreenRAM;
+
+    //Buffer clocked out by updateScreen(), the same as bSM16188ScreenRAM unless double buffered
+    bool _doubleBuffered;
+    byte *volatile bSM16188DisplayRAM;
+
+#if SM16188_TX_BUFFER
+    //Encoded frame clocked out by updateScreen(), see txBuffer()
+    byte *bSM16188TxRAM;
+#else
+    //Framebuffer or grayscale plane the frame in flight is read from
+    const byte *_sendFrame;
+#endif
+
+    //Grayscale bit planes below the most significant one, and the plane schedule
+    byte _grayBits;
+    byte _grayPlane;
+    byte _grayTick;
+    byte *_grayRAM;
+};
+
+//Tasks an SM16188Scheduler can hold
+#ifndef SM16188_MAX_TASKS
+#define SM16188_MAX_TASKS 8
+#endif
+
+//Function run by SM16188Scheduler, with the context given when the task was added
+typedef void (*SM16188TaskFunction)(void *context);
+
+//One task of SM16188Scheduler
+struct SM16188Task
+{
+    SM16188TaskFunction function; //NULL for a free slot
+    void *context;
+    unsigned long due;      //millis() of the next run, or the refresh count for frame tasks
+    unsigned long interval; //between runs, in ms or refreshes; 0 runs once
+    bool frame;             //paced by the display refresh instead of millis()
+};
+
+//Cooperative scheduler to run scenes, effects and other work (sensors, serial links) from
+//loop() instead of between delay() calls. Timed tasks run at their deadlines, the most
+//overdue first. Frame tasks run once every given number of refreshes of the display,
+//as counted by the refresh interrupt, within an optional render budget per refresh;
+//frame tasks that do not fit wait for the next refresh. After frame tasks have drawn,
+//a double buffered display is swapped. Tasks may add and cancel tasks, themselves included.
+template <class Display>
+class SM16188Scheduler
+{
+public:
+    SM16188Scheduler(Display &display) : _display(display), _budget(0), _refreshes(0), _nextFrameTask(0),
+                                         _budgetFrame(0), _budgetSpent(0), _budgetDrew(false), _budgetOver(false),
+                                         _maxLateness(0), _framesOverBudget(0)
+    {
+        memset(_tasks, 0, sizeof(_tasks));
+        _lastTick = display.refreshTicks();
+    }
+
+    //Run function every interval ms, the first time interval ms from now. Returns the task
+    //id, or -1 if all SM16188_MAX_TASKS are in use.
+    int every(unsigned long interval, SM16188TaskFunction function, void *context = NULL)
+    {
+        return add(function, context, millis() + interval, interval, false);
+    }
+
+    //Run function once, delay ms from now
+    int after(unsigned long delay, SM16188TaskFunction function, void *context = NULL)
+    {
+        return add(function, context, millis() + delay, 0, false);
+    }
+
+    //Run function once every refreshes refreshes of the display, to draw the next frame
+    int everyFrame(unsigned long refreshes, SM16188TaskFunction function, void *context = NULL)
+    {
+        if (refreshes < 1)
+            refreshes = 1;
+        return add(function, context, _refreshes + refreshes, refreshes, true);
+    }
+
+    //Remove a task, ids of removed tasks are ignored
+    void cancel(int id)
+    {
+        if (id >= 0 && id < SM16188_MAX_TASKS)
+            _tasks[id].function = NULL;
+    }
+
+    //Limit the time spent on frame tasks per refresh to us microseconds, 0 for no limit. One
+    //frame task always runs, so the limit is only checked between tasks.
+    void setRenderBudget(unsigned long us)
+    {
+        _budget = us;
+    }
+
+    //Run the tasks that are due, call from loop() as often as possible. Call it at least once
+    //every 255 refreshes so frame tasks keep count. Returns true if any task ran.
+    bool run()
+    {
+        byte tick = _display.refreshTicks();
+        _refreshes += (byte)(tick - _lastTick);
+        _lastTick = tick;
+
+        // timed tasks, the most overdue first
+        bool ran = false;
+        bool done[SM16188_MAX_TASKS] = {false};
+        for (;;)
+        {
+            unsigned long now = millis();
+            int next = -1;
+            unsigned long nextLateness = 0;
+            for (int i = 0; i < SM16188_MAX_TASKS; i++)
+            {
+                SM16188Task &task = _tasks[i];
+                if (!task.function || task.frame || done[i] || (long)(now - task.due) < 0)
+                    continue;
+                if (next < 0 || now - task.due > nextLateness)
+                {
+                    next = i;
+                    nextLateness = now - task.due;
+                }
+            }
+            if (next < 0)
+                break;
+            if (nextLateness > _maxLateness)
+                _maxLateness = nextLateness;
+            done[next] = true;
+            runTask(next, now);
+            ran = true;
+        }
+
+        // frame tasks within the budget of this frame, at least one per frame. Those left over
+        // stay due for the next frame and go first then.
+        if (_refreshes != _budgetFrame)
+        {
+            _budgetFrame = _refreshes;
+            _budgetSpent = 0;
+            _budgetDrew = false;
+            _budgetOver = false;
+        }
+        bool drew = false;
+        byte first = _nextFrameTask;
+        for (int n = 0; n < SM16188_MAX_TASKS; n++)
+        {
+            int i = (first + n) % SM16188_MAX_TASKS;
+            SM16188Task &task = _tasks[i];
+            if (!task.function || !task.frame || done[i] || (long)(_refreshes - task.due) < 0)
+                continue;
+            if (_budget && _budgetDrew && _budgetSpent >= _budget)
+            {
+                if (!_budgetOver)
+                {
+                    _nextFrameTask = i;
+                    _framesOverBudget++;
+                }
+                _budgetOver = true;
+                break;
+            }
+            unsigned long start = micros();
+            done[i] = true;
+            runTask(i, _refreshes);
+            _budgetSpent += micros() - start;
+            _budgetDrew = true;
+            drew = true;
+        }
+        if (drew)
+            _display.swapBuffers(true);
+        return ran || drew;
+    }
+
+    //Most ms a timed task has run after its deadline
+    unsigned long maxLateness()
+    {
+        return _maxLateness;
+    }
+
+    //Refreshes in which frame tasks were left for the next one to stay within the render budget
+    unsigned long framesOverBudget()
+    {
+        return _framesOverBudget;
+    }
+
+private:
+    int add(SM16188TaskFunction function, void *context, unsigned long due, unsigned long interval, bool frame)
+    {
+        for (int i = 0; i < SM16188_MAX_TASKS; i++)
+        {
+            SM16188Task &task = _tasks[i];
+            if (task.function)
+                continue;
+            task.function = function;
+            task.context = context;
+            task.due = due;
+            task.interval = interval;
+            task.frame = frame;
+            return i;
+        }
+        return -1;
+    }
+
+    //Reschedule task i, or free it if it runs once, then run it; now is in the task's units.
+    //Done before the call, so the function can cancel or add tasks.
+    void runTask(int i, unsigned long now)
+    {
+        SM16188Task &task = _tasks[i];
+        SM16188TaskFunction function = task.function;
+        void *context = task.context;
+        if (!task.interval)
+            task.function = NULL;
+        else if (now - task.due >= task.interval)
+            task.due = now + task.interval; // too far behind, skip the runs missed
+        else
+            task.due += task.interval;
+        function(context);
+    }
+
+    Display &_display;
+    SM16188Task _tasks[SM16188_MAX_TASKS];
+    unsigned long _budget;
+    unsigned long _refreshes; //refreshes counted from the display's refreshTicks()
+    byte _lastTick;
+    byte _nextFrameTask; //first frame task to try, the one the budget stopped at
+
+    //Render time spent in refresh _budgetFrame, whether a frame task ran in it and whether the
+    //budget stopped one
+    unsigned long _budgetFrame;
+    unsigned long _budgetSpent;
+    bool _budgetDrew;
+    bool _budgetOver;
+
+    unsigned long _maxLateness;
+    unsigned long _framesOverBudget;
 };
 
 #endif /* SM16188_H_ */